@@ -0,0 +1,45 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <algorithm>
+#include <cstdint>
+
+namespace trie_eval {
+
+using namespace std;
+
+// Number of queries in flight in lookup_batch() and reverse_lookup_batch().
+const uint64_t BATCH_WIDTH = 32;
+
+// interleave() processes n queries with up to BATCH_WIDTH of them in flight.
+// start() initializes a state for the i-th query and returns false if the
+// query is already done. round() advances every state by one step of its
+// traversal (a trie level or a node), which it splits into stages: a stage
+// runs over all the states before the next one starts and prefetches what
+// the next stage reads, so the cache misses of the states overlap. A state
+// whose query is done sets done and its slot is refilled with the next
+// query. Running the stages in lockstep rather than dispatching on a
+// per-state stage keeps the branches predictable.
+template <typename State, typename Start, typename Round>
+void interleave(uint64_t n, Start start, Round round) {
+  State states[BATCH_WIDTH];
+  uint64_t n_states = 0;
+  uint64_t next = 0;
+  while (n_states != 0 || next < n) {
+    while (n_states < BATCH_WIDTH && next < n) {
+      states[n_states].done = false;
+      if (start(states[n_states], next++)) {
+        ++n_states;
+      }
+    }
+    if (n_states != 0) {
+      round(states, n_states);
+      n_states = remove_if(states, states + n_states,
+        [](const State &state) { return state.done; }) - states;
+    }
+  }
+}
+
+}  // namespace trie_eval
+
+#endif  // BATCH_HPP
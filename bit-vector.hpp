@@ -1,12 +1,16 @@
 #ifndef BIT_VECTOR_HPP
 #define BIT_VECTOR_HPP
 
-#include <x86intrin.h>
-
+#include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <vector>
 
+#include "parallel.hpp"
+#include "popcount.hpp"
+#include "select-in-word.hpp"
+#include "vector.hpp"
+
 namespace trie_eval {
 
 using namespace std;
@@ -26,16 +30,36 @@ struct BitVector {
     }
   };
 
-  vector<uint64_t> words;
+  // Line is a unit of the interleaved layout, in which the number of 1s
+  // before a block and the block's 448 bits share a cache line. rank1()
+  // then touches one line instead of a Rank and a word in separate arrays.
+  struct alignas(64) Line {
+    uint64_t abs;
+    uint64_t words[7];
+  };
+
+  enum Flags : uint64_t {
+    INTERLEAVED = 1 << 0,
+    // CompressedBitVector may encode the bits with Elias-Fano or RRR.
+    // BitVector ignores it.
+    COMPRESSED = 1 << 1,
+    // build() makes the samples of select0() and select1() only if asked
+    // to, as most vectors use one or neither.
+    SELECT0 = 1 << 2,
+    SELECT1 = 1 << 3,
+  };
+
+  Vector<uint64_t> words;
   uint64_t n_bits;
-  vector<Rank> ranks;
-  vector<uint64_t> select0s;
-  vector<uint64_t> select1s;
+  Vector<Rank> ranks;
+  Vector<uint64_t> select0s;
+  Vector<uint64_t> select1s;
+  Vector<Line> lines;
   uint64_t n_zeros;
   uint64_t n_ones;
 
   BitVector()
-    : words(), n_bits(0), ranks(), select0s(), select1s(),
+    : words(), n_bits(0), ranks(), select0s(), select1s(), lines(),
       n_zeros(0), n_ones(0) {}
   ~BitVector() {}
 
@@ -43,15 +67,77 @@ struct BitVector {
     return (sizeof(uint64_t) * words.size())
       + (sizeof(Rank) * ranks.size())
       + (sizeof(uint64_t) * select0s.size())
-      + (sizeof(uint64_t) * select1s.size());
+      + (sizeof(uint64_t) * select1s.size())
+      + (sizeof(Line) * lines.size());
+  }
+
+  void write(Writer &writer) const {
+    words.write(writer);
+    writer.write(n_bits);
+    ranks.write(writer);
+    select0s.write(writer);
+    select1s.write(writer);
+    lines.write(writer);
+    writer.write(n_zeros);
+    writer.write(n_ones);
+  }
+  void map(Mapper &mapper) {
+    words.map(mapper);
+    mapper.map(n_bits);
+    ranks.map(mapper);
+    select0s.map(mapper);
+    select1s.map(mapper);
+    lines.map(mapper);
+    mapper.map(n_zeros);
+    mapper.map(n_ones);
   }
 
+  bool interleaved() const {
+    return !lines.empty();
+  }
+
+  uint64_t word(uint64_t word_id) const {
+    if (interleaved()) {
+      return lines[word_id / 7].words[word_id % 7];
+    }
+    return words[word_id];
+  }
   uint64_t operator[](uint64_t i) const {
     assert(i < n_bits);
-    return (words[i / 64] >> (i % 64)) & 1;
+    return (word(i / 64) >> (i % 64)) & 1;
+  }
+  // next1() returns the position of the first 1 at or after i, which must
+  // exist. A run of 0s is skipped 128 bits at a time with SSE4.1, as the
+  // size of words is a multiple of 4.
+  uint64_t next1(uint64_t i) const {
+    uint64_t word_id = i / 64;
+    uint64_t bits = word(word_id) >> (i % 64);
+    if (bits != 0) {
+      return i + __builtin_ctzll(bits);
+    }
+    ++word_id;
+    if (!interleaved()) {
+      if ((word_id % 2) != 0) {
+        if (words[word_id] != 0) {
+          return (word_id * 64) + __builtin_ctzll(words[word_id]);
+        }
+        ++word_id;
+      }
+      for ( ; ; word_id += 2) {
+        __m128i pair = _mm_loadu_si128((const __m128i *)&words[word_id]);
+        if (!_mm_testz_si128(pair, pair)) {
+          break;
+        }
+      }
+    }
+    while ((bits = word(word_id)) == 0) {
+      ++word_id;
+    }
+    return (word_id * 64) + __builtin_ctzll(bits);
   }
   void set(uint64_t i, uint64_t bit) {
     assert(i < n_bits);
+    assert(!interleaved());
     if (bit) {
       words[i / 64] |= (1UL << (i % 64));
     } else {
@@ -59,7 +145,17 @@ struct BitVector {
     }
   }
 
+  // set_shared() sets the i-th bit to 1 atomically, so that threads can set
+  // bits in the same word.
+  void set_shared(uint64_t i) {
+    assert(i < n_bits);
+    assert(!interleaved());
+    atomic_ref<uint64_t>(words[i / 64]).fetch_or(1UL << (i % 64),
+      memory_order_relaxed);
+  }
+
   void add(uint64_t bit) {
+    assert(!interleaved());
     if (n_bits % 256 == 0) {
       words.resize((n_bits + 256) / 64, 0);
     }
@@ -68,64 +164,152 @@ struct BitVector {
     }
     ++n_bits;
   }
+  // resize() appends 0s as add() does, so that they can be set in any order.
+  void resize(uint64_t n) {
+    assert(!interleaved());
+    assert(n >= n_bits);
+    words.resize((n != 0) ? (((n - 1) / 256) + 1) * 4 : 0, 0);
+    n_bits = n;
+  }
+  // reserve() allocates words for n bits, so that adding up to n bits does
+  // not reallocate.
+  void reserve(uint64_t n) {
+    words.reserve(((n + 255) / 256) * 4);
+  }
+  // append_bits() appends the lower n bits of word, from the lowest, with at
+  // most two word writes.
+  void append_bits(uint64_t word, uint64_t n) {
+    assert(n <= 64);
+    if (n == 0) {
+      return;
+    }
+    if (n < 64) {
+      word &= (1UL << n) - 1;
+    }
+    uint64_t pos = n_bits;
+    resize(n_bits + n);
+    words[pos / 64] |= word << (pos % 64);
+    if ((pos % 64) + n > 64) {
+      words[(pos / 64) + 1] |= word >> (64 - (pos % 64));
+    }
+  }
+  // append_run() appends n copies of bit.
+  void append_run(uint64_t bit, uint64_t n) {
+    if (!bit) {
+      resize(n_bits + n);
+      return;
+    }
+    for ( ; n > 64; n -= 64) {
+      append_bits(~0UL, 64);
+    }
+    append_bits(~0UL, n);
+  }
+  // append() appends the first n bits of rhs.
+  void append(const BitVector &rhs, uint64_t n) {
+    assert(n <= rhs.n_bits);
+    reserve(n_bits + n);
+    for (uint64_t i = 0; i < n; i += 64) {
+      append_bits(rhs.word(i / 64), min(n - i, (uint64_t)64));
+    }
+  }
 
-  void build() {
+  // build() makes the indexes. Chunks of at least MIN_CHUNK_BLOCKS blocks
+  // are indexed on up to n_threads threads, each from the number of 1s in
+  // the chunks before it, which a first pass counts. The indexes are the
+  // same for any n_threads.
+  void build(uint64_t flags = SELECT0 | SELECT1, uint64_t n_threads = 1) {
+    if (flags & INTERLEAVED) {
+      build_lines(flags);
+      return;
+    }
     uint64_t n_blocks = words.size() / 4;
     ranks.resize(n_blocks + 1);
-    n_zeros = 0;
-    n_ones = 0;
-    for (uint64_t block_id = 0; block_id < n_blocks; ++block_id) {
-      ranks[block_id].set_abs(n_ones);
-      for (uint64_t j = 0; j < 4; ++j) {
-        if (j != 0) {
-          uint64_t rel = n_ones - ranks[block_id].abs();
-          ranks[block_id].rels[j - 1] = rel;
-        }
-
-        uint64_t word_id = (block_id * 4) + j;
-        uint64_t n_pops = __builtin_popcountll(words[word_id]);
-        uint64_t new_n_zeros = n_zeros + 64 - n_pops;
-        if (((n_zeros + 255) / 256) != ((new_n_zeros + 255) / 256)) {
-          uint64_t count = n_zeros;
-          uint64_t word = ~words[word_id];
-          while (word != 0) {
-            uint64_t pos = __builtin_ctzll(word);
-            if (count % 256 == 0) {
-              select0s.push_back(((word_id * 64) + pos) >> 8);
-              break;
-            }
-            word ^= 1UL << pos;
-            ++count;
-          }
-        }
-        n_zeros = new_n_zeros;
-
-        uint64_t new_n_ones = n_ones + n_pops;
-        if (((n_ones + 255) / 256) != ((new_n_ones + 255) / 256)) {
-          uint64_t count = n_ones;
-          uint64_t word = words[word_id];
-          while (word != 0) {
-            uint64_t pos = __builtin_ctzll(word);
-            if (count % 256 == 0) {
-              select1s.push_back(((word_id * 64) + pos) >> 8);
-              break;
-            }
-            word ^= 1UL << pos;
-            ++count;
-          }
+    uint64_t n_chunks = max(min(n_threads, n_blocks / MIN_CHUNK_BLOCKS), 1UL);
+    vector<uint64_t> bounds(n_chunks + 1);
+    for (uint64_t i = 0; i <= n_chunks; ++i) {
+      bounds[i] = n_blocks * i / n_chunks;
+    }
+    vector<uint64_t> offsets(n_chunks + 1, 0);
+    if (n_chunks > 1) {
+      parallel(n_threads, n_chunks, [&](uint64_t chunk_id) {
+        uint64_t counts[4];
+        uint64_t n = 0;
+        for (uint64_t block_id = bounds[chunk_id];
+          block_id < bounds[chunk_id + 1]; ++block_id) {
+          popcount_block(words.data() + (block_id * 4), counts);
+          n += counts[0] + counts[1] + counts[2] + counts[3];
         }
-        n_ones = new_n_ones;
+        offsets[chunk_id + 1] = n;
+      });
+      for (uint64_t i = 0; i < n_chunks; ++i) {
+        offsets[i + 1] += offsets[i];
       }
     }
+    vector<vector<uint64_t>> samples0(n_chunks);
+    vector<vector<uint64_t>> samples1(n_chunks);
+    parallel(n_threads, n_chunks, [&](uint64_t chunk_id) {
+      offsets[chunk_id + 1] = build_blocks(bounds[chunk_id],
+        bounds[chunk_id + 1], offsets[chunk_id], flags, samples0[chunk_id],
+        samples1[chunk_id]);
+    });
+    n_ones = offsets[n_chunks];
+    n_zeros = (n_blocks * 256) - n_ones;
     ranks.back().set_abs(n_ones);
-    select0s.push_back(words.size() * 64 / 256);
-    select1s.push_back(words.size() * 64 / 256);
+    for (uint64_t i = 0; i < n_chunks; ++i) {
+      for (uint64_t sample : samples0[i]) {
+        select0s.push_back(sample);
+      }
+      for (uint64_t sample : samples1[i]) {
+        select1s.push_back(sample);
+      }
+    }
+    if (flags & SELECT0) {
+      select0s.push_back(words.size() * 64 / 256);
+    }
+    if (flags & SELECT1) {
+      select1s.push_back(words.size() * 64 / 256);
+    }
+  }
+
+  // Prefetch helpers for software-pipelined queries. prefetch_rank(i)
+  // fetches what rank1(i) reads. select1(i) reads a sample and then the
+  // block it points to, so prefetch_select1_sample(i) should be issued a
+  // step before prefetch_select1_block(i), which reads the sample.
+  void prefetch(uint64_t i) const {
+    if (interleaved()) {
+      __builtin_prefetch(lines.data() + (i / 448));
+    } else {
+      __builtin_prefetch(words.data() + (i / 64));
+    }
+  }
+  void prefetch_rank(uint64_t i) const {
+    if (interleaved()) {
+      __builtin_prefetch(lines.data() + (i / 448));
+    } else {
+      __builtin_prefetch(ranks.data() + (i / 256));
+      __builtin_prefetch(words.data() + (i / 64));
+    }
+  }
+  void prefetch_select0_sample(uint64_t i) const {
+    __builtin_prefetch(select0s.data() + (i / 256));
+  }
+  void prefetch_select0_block(uint64_t i) const {
+    prefetch_block(select0s[i / 256]);
+  }
+  void prefetch_select1_sample(uint64_t i) const {
+    __builtin_prefetch(select1s.data() + (i / 256));
+  }
+  void prefetch_select1_block(uint64_t i) const {
+    prefetch_block(select1s[i / 256]);
   }
 
   uint64_t rank0(uint64_t i) const {
     return i - rank1(i);
   }
   uint64_t rank1(uint64_t i) const {
+    if (interleaved()) {
+      return rank1_lines(i);
+    }
     uint64_t word_id = i / 64;
     uint64_t bit_id = i % 64;
     uint64_t rank_id = word_id / 4;
@@ -139,6 +323,10 @@ struct BitVector {
   }
 
   uint64_t select0(uint64_t i) const {
+    assert(!select0s.empty());
+    if (interleaved()) {
+      return select0_lines(i);
+    }
     const uint64_t block_id = i / 256;
     uint64_t begin = select0s[block_id];
     uint64_t end = select0s[block_id + 1] + 1;
@@ -172,10 +360,14 @@ struct BitVector {
       word_id += 3;
       i -= 192UL - ranks[rank_id].rels[2];
     }
-    return (word_id * 64) + __builtin_ctzll(
-      _pdep_u64(1UL << i, ~words[word_id]));
+    return (word_id * 64) + select_in_word(
+      ~words[word_id], i);
   }
   uint64_t select1(uint64_t i) const {
+    assert(!select1s.empty());
+    if (interleaved()) {
+      return select1_lines(i);
+    }
     const uint64_t block_id = i / 256;
     uint64_t begin = select1s[block_id];
     uint64_t end = select1s[block_id + 1] + 1;
@@ -209,8 +401,162 @@ struct BitVector {
       word_id += 3;
       i -= ranks[rank_id].rels[2];
     }
-    return (word_id * 64) + __builtin_ctzll(
-      _pdep_u64(1UL << i, words[word_id]));
+    return (word_id * 64) + select_in_word(
+      words[word_id], i);
+  }
+ private:
+  static const uint64_t MIN_CHUNK_BLOCKS = 4096;
+
+  // build_blocks() fills ranks[begin, end) and the select samples in them,
+  // given n_ones before them, and returns the number of 1s up to end. A
+  // sample is the block of every 256th 0 or 1.
+  uint64_t build_blocks(uint64_t begin, uint64_t end, uint64_t n_ones,
+    uint64_t flags, vector<uint64_t> &samples0,
+    vector<uint64_t> &samples1) {
+    uint64_t n_zeros = (begin * 256) - n_ones;
+    uint64_t counts[4];
+    for (uint64_t block_id = begin; block_id < end; ++block_id) {
+      ranks[block_id].set_abs(n_ones);
+      popcount_block(words.data() + (block_id * 4), counts);
+      for (uint64_t j = 0; j < 4; ++j) {
+        if (j != 0) {
+          ranks[block_id].rels[j - 1] = n_ones - ranks[block_id].abs();
+        }
+        uint64_t word_id = (block_id * 4) + j;
+        uint64_t target = ((n_zeros + 255) / 256) * 256;
+        if ((flags & SELECT0) && target < n_zeros + 64 - counts[j]) {
+          samples0.push_back(((word_id * 64) +
+            select_in_word(~words[word_id], target - n_zeros)) >> 8);
+        }
+        n_zeros += 64 - counts[j];
+        target = ((n_ones + 255) / 256) * 256;
+        if ((flags & SELECT1) && target < n_ones + counts[j]) {
+          samples1.push_back(((word_id * 64) +
+            select_in_word(words[word_id], target - n_ones)) >> 8);
+        }
+        n_ones += counts[j];
+      }
+    }
+    return n_ones;
+  }
+
+  void prefetch_block(uint64_t id) const {
+    if (interleaved()) {
+      __builtin_prefetch(lines.data() + id);
+    } else {
+      __builtin_prefetch(ranks.data() + id);
+      __builtin_prefetch(words.data() + (id * 4));
+    }
+  }
+
+  void build_lines(uint64_t flags) {
+    uint64_t n_lines = (n_bits / 448) + 1;
+    lines.resize(n_lines + 1);
+    n_zeros = 0;
+    n_ones = 0;
+    for (uint64_t line_id = 0; line_id < n_lines; ++line_id) {
+      Line &line = lines[line_id];
+      line.abs = n_ones;
+      for (uint64_t j = 0; j < 7; ++j) {
+        uint64_t word_id = (line_id * 7) + j;
+        line.words[j] = (word_id < words.size()) ? words[word_id] : 0;
+        uint64_t n_pops = __builtin_popcountll(line.words[j]);
+        uint64_t new_n_zeros = n_zeros + 64 - n_pops;
+        if ((flags & SELECT0) &&
+          ((n_zeros + 255) / 256) != ((new_n_zeros + 255) / 256)) {
+          select0s.push_back(line_id);
+        }
+        n_zeros = new_n_zeros;
+        uint64_t new_n_ones = n_ones + n_pops;
+        if ((flags & SELECT1) &&
+          ((n_ones + 255) / 256) != ((new_n_ones + 255) / 256)) {
+          select1s.push_back(line_id);
+        }
+        n_ones = new_n_ones;
+      }
+    }
+    lines[n_lines].abs = n_ones;
+    if (flags & SELECT0) {
+      select0s.push_back(n_lines);
+    }
+    if (flags & SELECT1) {
+      select1s.push_back(n_lines);
+    }
+    words = Vector<uint64_t>();
+  }
+
+  uint64_t rank1_lines(uint64_t i) const {
+    const Line &line = lines[i / 448];
+    uint64_t word_id = (i % 448) / 64;
+    uint64_t n = line.abs;
+    for (uint64_t j = 0; j < word_id; ++j) {
+      n += __builtin_popcountll(line.words[j]);
+    }
+    n += __builtin_popcountll(line.words[word_id] & ((1UL << (i % 64)) - 1));
+    return n;
+  }
+
+  uint64_t select0_lines(uint64_t i) const {
+    const uint64_t block_id = i / 256;
+    uint64_t begin = select0s[block_id];
+    uint64_t end = select0s[block_id + 1] + 1;
+    if (begin + 10 >= end) {
+      while (i >= (448 * (begin + 1)) - lines[begin + 1].abs) {
+        ++begin;
+      }
+    } else {
+      while (begin + 1 < end) {
+        const uint64_t middle = (begin + end) / 2;
+        if (i < (448 * middle) - lines[middle].abs) {
+          end = middle;
+        } else {
+          begin = middle;
+        }
+      }
+    }
+    const Line &line = lines[begin];
+    i -= (448 * begin) - line.abs;
+    uint64_t word_id = 0;
+    for ( ; ; ++word_id) {
+      uint64_t n_zeros = 64 - __builtin_popcountll(line.words[word_id]);
+      if (i < n_zeros) {
+        break;
+      }
+      i -= n_zeros;
+    }
+    return (begin * 448) + (word_id * 64) + select_in_word(
+      ~line.words[word_id], i);
+  }
+  uint64_t select1_lines(uint64_t i) const {
+    const uint64_t block_id = i / 256;
+    uint64_t begin = select1s[block_id];
+    uint64_t end = select1s[block_id + 1] + 1;
+    if (begin + 10 >= end) {
+      while (i >= lines[begin + 1].abs) {
+        ++begin;
+      }
+    } else {
+      while (begin + 1 < end) {
+        const uint64_t middle = (begin + end) / 2;
+        if (i < lines[middle].abs) {
+          end = middle;
+        } else {
+          begin = middle;
+        }
+      }
+    }
+    const Line &line = lines[begin];
+    i -= line.abs;
+    uint64_t word_id = 0;
+    for ( ; ; ++word_id) {
+      uint64_t n_ones = __builtin_popcountll(line.words[word_id]);
+      if (i < n_ones) {
+        break;
+      }
+      i -= n_ones;
+    }
+    return (begin * 448) + (word_id * 64) + select_in_word(
+      line.words[word_id], i);
   }
 };
 
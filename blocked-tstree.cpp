@@ -0,0 +1,627 @@
+#include "blocked-tstree.hpp"
+
+#include <algorithm>
+#include <deque>
+
+#include "batch.hpp"
+
+namespace trie_eval {
+namespace {
+
+// A lookup takes the steps in a block at once and then waits in a stage
+// for what is out of the block.
+enum Step {
+  NODE,
+  LINK,
+  ROOT,
+  END,
+};
+
+struct LookupState {
+  string_view query;
+  uint64_t *id;
+  uint64_t i;
+  uint64_t node_id;
+  // pos is an index of root_nodes_ in ROOT, and a tail ID and then its
+  // position in LINK.
+  uint64_t pos;
+  Step step;
+  bool done;
+};
+
+}  // namespace
+
+BlockedTSTree::BlockedTSTree(uint64_t flags)
+  : blocks_(), root_nodes_(), roots_(), parents_(), outs_(), links_(),
+    tail_bits_(), tail_bytes_(), n_keys_(0), n_nodes_(0), size_(0),
+    flags_(flags), mapper_() {}
+
+void BlockedTSTree::build(const vector<string> &keys) {
+  TSTree tree;
+  tree.build(keys);
+  build(tree);
+}
+
+void BlockedTSTree::Builder::finish() {
+  builder_.finish();
+  trie_.build(tree_);
+}
+
+void BlockedTSTree::build(const vector<string> &keys, uint64_t n_threads) {
+  build(keys, span<const uint64_t>(), n_threads);
+}
+
+void BlockedTSTree::build(const vector<string> &keys,
+  span<const uint64_t> weights, uint64_t n_threads) {
+  TSTree tree;
+  tree.build(keys, weights, n_threads);
+  build(tree);
+}
+
+// build() packs the nodes of tree into blocks. A subtree of more than
+// BLOCK_SIZE nodes gets a block of its top nodes in level order, whose
+// children out of the block become roots of their own. The other subtrees
+// are then packed whole, largest first, into the room left in a block.
+void BlockedTSTree::build(const TSTree &tree) {
+  uint64_t bv_flags = 0;
+  if (flags_ & TRIE_INTERLEAVED) {
+    bv_flags |= BitVector::INTERLEAVED;
+  }
+  uint64_t cbv_flags = bv_flags;
+  if (flags_ & TRIE_COMPRESSED) {
+    cbv_flags |= BitVector::COMPRESSED;
+  }
+
+  // sizes[tree_id] is the number of nodes in the subtree of a node of tree,
+  // whose children come after it in level order.
+  uint64_t n_tree_nodes = tree.n_nodes();
+  vector<uint64_t> sizes(n_tree_nodes, 1);
+  for (uint64_t tree_id = n_tree_nodes; tree_id-- > 0; ) {
+    for (uint64_t kind = LO; kind <= HI; ++kind) {
+      uint64_t child_id = tree.child((tree_id * 3) + kind);
+      if (child_id != 0) {
+        sizes[tree_id] += sizes[child_id];
+      }
+    }
+  }
+
+  // node_ids[tree_id] is the ID of a node in the blocks and
+  // tree_parents[tree_id] is tree_parent_id * 3 + kind.
+  vector<uint64_t> node_ids(n_tree_nodes);
+  vector<uint64_t> tree_parents(n_tree_nodes, 0);
+  // root_nodes has the roots of children out of blocks as tree IDs.
+  vector<uint64_t> root_nodes;
+  deque<uint64_t> large_roots;
+  vector<vector<uint64_t>> small_roots(BLOCK_SIZE + 1);
+  auto add_root = [&](uint64_t tree_id) {
+    if (sizes[tree_id] > BLOCK_SIZE) {
+      large_roots.push_back(tree_id);
+    } else {
+      small_roots[sizes[tree_id]].push_back(tree_id);
+    }
+  };
+  vector<uint64_t> queue;
+  auto add_block = [&](const vector<uint64_t> &roots) {
+    assert(root_nodes.size() <= UINT32_MAX);
+    Block block = {};
+    block.first_root = root_nodes.size();
+    block.n_roots = roots.size();
+    queue.assign(roots.begin(), roots.end());
+    for (uint64_t i = 0; i < queue.size(); ++i) {
+      uint64_t tree_id = queue[i];
+      if (block.n_nodes == BLOCK_SIZE) {
+        root_nodes.push_back(tree_id);
+        add_root(tree_id);
+        continue;
+      }
+      uint64_t slot = block.n_nodes++;
+      node_ids[tree_id] = (blocks_.size() * BLOCK_SIZE) + slot;
+      block.labels[slot] = tree.labels_[tree_id];
+      block.links |= (uint64_t)tree.links_[tree_id] << slot;
+      for (uint64_t kind = LO; kind <= HI; ++kind) {
+        uint64_t child_id = tree.child((tree_id * 3) + kind);
+        if (child_id != 0) {
+          uint64_t pos = (slot * 3) + kind;
+          block.children[pos / 64] |= 1UL << (pos % 64);
+          tree_parents[child_id] = (tree_id * 3) + kind;
+          queue.push_back(child_id);
+        }
+      }
+    }
+    blocks_.push_back(block);
+  };
+
+  blocks_.clear();
+  add_root(0);
+  vector<uint64_t> roots;
+  while (!large_roots.empty()) {
+    roots.assign(1, large_roots.front());
+    large_roots.pop_front();
+    add_block(roots);
+  }
+  for ( ; ; ) {
+    roots.clear();
+    uint64_t room = BLOCK_SIZE;
+    for (uint64_t size = BLOCK_SIZE; size != 0; --size) {
+      while (size <= room && !small_roots[size].empty()) {
+        roots.push_back(small_roots[size].back());
+        small_roots[size].pop_back();
+        room -= size;
+      }
+    }
+    if (roots.empty()) {
+      break;
+    }
+    add_block(roots);
+  }
+
+  uint64_t n_ids = blocks_.size() * BLOCK_SIZE;
+  root_nodes_.init(root_nodes.size(), n_ids - 1);
+  for (uint64_t i = 0; i < root_nodes.size(); ++i) {
+    root_nodes_.set(i, node_ids[root_nodes[i]]);
+  }
+  vector<uint64_t> tree_ids(n_ids, -1);
+  for (uint64_t tree_id = 0; tree_id < n_tree_nodes; ++tree_id) {
+    tree_ids[node_ids[tree_id]] = tree_id;
+  }
+
+  // The root of the tree is a root without a parent.
+  roots_ = BitVector();
+  roots_.resize(n_ids);
+  parents_.init(root_nodes.size() + 1, (n_ids * 3) - 1);
+  outs_ = CompressedBitVector();
+  outs_.resize(n_ids);
+  links_ = CompressedBitVector();
+  links_.resize(n_ids);
+  tail_bits_ = BitVector();
+  tail_bytes_.clear();
+  uint64_t n_roots = 0;
+  for (uint64_t node_id = 0; node_id < n_ids; ++node_id) {
+    uint64_t tree_id = tree_ids[node_id];
+    if (tree_id == (uint64_t)-1) {
+      continue;
+    }
+    if ((node_id % BLOCK_SIZE) < block(node_id).n_roots) {
+      roots_.set(node_id, 1);
+      uint64_t tree_parent = tree_parents[tree_id];
+      parents_.set(n_roots++,
+        (node_ids[tree_parent / 3] * 3) + (tree_parent % 3));
+    }
+    if (tree.outs_[tree_id]) {
+      outs_.set(node_id, 1);
+    }
+    if (tree.links_[tree_id]) {
+      links_.set(node_id, 1);
+      uint64_t tail_pos = tree.tail_bits_.select1(tree.links_.rank1(tree_id));
+      tail_bits_.add(1);
+      tail_bytes_.push_back(tree.tail_bytes_[tail_pos]);
+      while (!tree.tail_bits_[++tail_pos]) {
+        tail_bits_.add(0);
+        tail_bytes_.push_back(tree.tail_bytes_[tail_pos]);
+      }
+    }
+  }
+  assert(n_roots == root_nodes.size() + 1);
+
+  roots_.build(bv_flags);
+  outs_.build(cbv_flags | BitVector::SELECT1);
+  links_.build(cbv_flags);
+  tail_bits_.add(1);
+  tail_bits_.build(bv_flags | BitVector::SELECT1);
+
+  n_keys_ = tree.n_keys();
+  n_nodes_ = n_tree_nodes;
+  size_ = sizeof(Block) * blocks_.size();
+  size_ += root_nodes_.size();
+  size_ += roots_.size();
+  size_ += parents_.size();
+  size_ += outs_.size();
+  size_ += links_.size();
+  size_ += tail_bits_.size();
+  size_ += tail_bytes_.size();
+}
+
+uint64_t BlockedTSTree::lookup(const string &query) const {
+  // The empty key is stored in the root.
+  uint64_t node_id = 0;
+  if (!query.empty()) {
+    node_id = child(0, MIDDLE);
+    if (node_id == 0) {
+      return -1;
+    }
+  }
+  for (uint64_t i = 0; i < query.length(); ) {
+    uint8_t byte = query[i];
+    uint8_t label = this->label(node_id);
+    uint64_t kind;
+    if (byte < label) {
+      kind = LO;
+    } else if (byte > label) {
+      kind = HI;
+    } else {
+      if (link(node_id)) {
+        uint64_t tail_pos = this->tail_pos(node_id);
+        for (++i; i < query.length(); ++i) {
+          if (tail_bytes_[tail_pos] != (uint8_t)query[i]) {
+            return -1;
+          }
+          ++tail_pos;
+          if (tail_bits_[tail_pos]) {
+            break;
+          }
+        }
+        if (i == query.length()) {
+          return -1;
+        }
+      }
+      if (++i == query.length()) {
+        break;
+      }
+      kind = MIDDLE;
+    }
+    node_id = child(node_id, kind);
+    if (node_id == 0) {
+      return -1;
+    }
+  }
+  if (!outs_[node_id]) {
+    return -1;
+  }
+  return outs_.rank1(node_id);
+}
+
+void BlockedTSTree::reverse_lookup(uint64_t id, string &key) const {
+  assert(id < n_keys());
+  key.clear();
+  uint64_t node_id = outs_.select1(id);
+  while (node_id != 0) {
+    if (link(node_id)) {
+      uint64_t tail_id = links_.rank1(node_id);
+      uint64_t tail_pos = tail_bits_.select1(tail_id + 1);
+      do {
+        key.push_back(tail_bytes_[--tail_pos]);
+      } while (!tail_bits_[tail_pos]);
+    }
+    key.push_back(label(node_id));
+    uint64_t kind;
+    do {
+      node_id = parent(node_id, kind);
+    } while (kind != MIDDLE);
+  }
+  reverse(key.begin(), key.end());
+}
+
+void BlockedTSTree::lookup_batch(span<const string_view> queries,
+  span<uint64_t> ids) const {
+  assert(queries.size() == ids.size());
+  // move() moves a state on to the kind-th child of its node. A child out
+  // of the block is left to the ROOT stage.
+  auto move = [this](LookupState &state, uint64_t kind) {
+    const Block &block = this->block(state.node_id);
+    uint64_t slot = state.node_id % BLOCK_SIZE;
+    uint64_t index = block.child(slot, kind);
+    if (index == (uint64_t)-1) {
+      *state.id = -1;
+      state.done = true;
+    } else if (index < block.n_nodes) {
+      state.node_id += index - slot;
+    } else {
+      state.pos = block.first_root + (index - block.n_nodes);
+      state.step = ROOT;
+      root_nodes_.prefetch(state.pos);
+    }
+  };
+  // advance() takes the steps of a state in its block until it needs a
+  // tail, another block or the end of the query.
+  auto advance = [&](LookupState &state) {
+    while (!state.done && state.step == NODE) {
+      uint8_t byte = state.query[state.i];
+      uint8_t label = this->label(state.node_id);
+      if (byte < label) {
+        move(state, LO);
+      } else if (byte > label) {
+        move(state, HI);
+      } else if (link(state.node_id)) {
+        state.step = LINK;
+        links_.prefetch_rank(state.node_id);
+      } else if (++state.i == state.query.length()) {
+        state.step = END;
+        outs_.prefetch_rank(state.node_id);
+      } else {
+        move(state, MIDDLE);
+      }
+    }
+  };
+  // match_tail() matches the tail which starts at pos against the rest of
+  // the query and moves i to its last byte.
+  auto match_tail = [this](LookupState &state) {
+    uint64_t tail_pos = state.pos;
+    for (++state.i; state.i < state.query.length(); ++state.i) {
+      if (tail_bytes_[tail_pos] != (uint8_t)state.query[state.i]) {
+        return false;
+      }
+      ++tail_pos;
+      if (tail_bits_[tail_pos]) {
+        break;
+      }
+    }
+    return state.i != state.query.length();
+  };
+  interleave<LookupState>(queries.size(),
+    [&](LookupState &state, uint64_t i) {
+      state.query = queries[i];
+      state.id = &ids[i];
+      state.i = 0;
+      state.node_id = 0;
+      state.step = NODE;
+      if (state.query.empty()) {
+        *state.id = outs_[0] ? outs_.rank1(0) : -1;
+        return false;
+      }
+      move(state, MIDDLE);
+      return !state.done;
+    },
+    // A round takes each state through its block and then out of it.
+    [&](LookupState *states, uint64_t n_states) {
+      uint64_t n_links = 0;
+      for (uint64_t j = 0; j < n_states; ++j) {
+        advance(states[j]);
+        if (!states[j].done && states[j].step == LINK) {
+          ++n_links;
+        }
+      }
+      if (n_links != 0) {
+        for (uint64_t j = 0; j < n_states; ++j) {
+          LookupState &state = states[j];
+          if (!state.done && state.step == LINK) {
+            state.pos = links_.rank1(state.node_id);
+            tail_bits_.prefetch_select1_sample(state.pos);
+          }
+        }
+        for (uint64_t j = 0; j < n_states; ++j) {
+          const LookupState &state = states[j];
+          if (!state.done && state.step == LINK) {
+            tail_bits_.prefetch_select1_block(state.pos);
+          }
+        }
+        for (uint64_t j = 0; j < n_states; ++j) {
+          LookupState &state = states[j];
+          if (!state.done && state.step == LINK) {
+            state.pos = tail_bits_.select1(state.pos);
+            tail_bits_.prefetch(state.pos);
+            __builtin_prefetch(tail_bytes_.data() + state.pos);
+          }
+        }
+        for (uint64_t j = 0; j < n_states; ++j) {
+          LookupState &state = states[j];
+          if (state.done || state.step != LINK) {
+            continue;
+          }
+          state.step = NODE;
+          if (!match_tail(state)) {
+            *state.id = -1;
+            state.done = true;
+          } else if (++state.i == state.query.length()) {
+            state.step = END;
+            outs_.prefetch_rank(state.node_id);
+          } else {
+            move(state, MIDDLE);
+          }
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        if (!state.done && state.step == ROOT) {
+          state.node_id = root_nodes_[state.pos];
+          state.step = NODE;
+          __builtin_prefetch(&block(state.node_id));
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        if (!state.done && state.step == END) {
+          *state.id = outs_[state.node_id] ? outs_.rank1(state.node_id) : -1;
+          state.done = true;
+        }
+      }
+    });
+}
+
+bool BlockedTSTree::Cursor::next() {
+  while (!stack_.empty()) {
+    Frame &frame = stack_.back();
+    uint64_t node_id = frame.node_id;
+    uint64_t key_length = frame.key_length;
+    switch (frame.step) {
+      case LO: {
+        frame.step = MIDDLE;
+        uint64_t child_id = trie_->child(node_id, BlockedTSTree::LO);
+        if (child_id != 0) {
+          stack_.push_back(Frame{ child_id, key_length, LO });
+        }
+        break;
+      }
+      case MIDDLE: {
+        frame.step = HI;
+        key_.resize(key_length);
+        if (node_id != 0) {
+          key_.push_back(trie_->label(node_id));
+          if (trie_->link(node_id)) {
+            uint64_t tail_pos = trie_->tail_pos(node_id);
+            do {
+              key_.push_back(trie_->tail_bytes_[tail_pos]);
+            } while (!trie_->tail_bits_[++tail_pos]);
+          }
+        }
+        uint64_t child_id = trie_->child(node_id, BlockedTSTree::MIDDLE);
+        if (child_id != 0) {
+          stack_.push_back(Frame{ child_id, key_.length(), LO });
+        }
+        if (trie_->outs_[node_id]) {
+          id_ = trie_->outs_.rank1(node_id);
+          return true;
+        }
+        break;
+      }
+      case HI: {
+        // The hi subtree replaces the node. The bottom frame is the root of
+        // the search and its siblings are out of range.
+        stack_.pop_back();
+        uint64_t child_id = trie_->child(node_id, BlockedTSTree::HI);
+        if (child_id != 0 && !stack_.empty()) {
+          stack_.push_back(Frame{ child_id, key_length, LO });
+        }
+        break;
+      }
+    }
+  }
+  return false;
+}
+
+void BlockedTSTree::predictive_search(string_view prefix,
+  Cursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.stack_.clear();
+  cursor.key_.clear();
+  cursor.id_ = -1;
+  uint64_t node_id = 0;
+  uint64_t key_length = 0;
+  for (uint64_t i = 0; i < prefix.length(); ) {
+    if (node_id == 0) {
+      node_id = child(0, MIDDLE);
+    } else {
+      uint8_t byte = prefix[i];
+      if (byte < label(node_id)) {
+        node_id = child(node_id, LO);
+      } else if (byte > label(node_id)) {
+        node_id = child(node_id, HI);
+      } else {
+        key_length = i++;
+        if (link(node_id)) {
+          // The prefix may end in the middle of the tail.
+          uint64_t tail_pos = this->tail_pos(node_id);
+          do {
+            if (i == prefix.length()) {
+              break;
+            } else if (tail_bytes_[tail_pos] != (uint8_t)prefix[i]) {
+              return;
+            }
+            ++i;
+          } while (!tail_bits_[++tail_pos]);
+        }
+        if (i == prefix.length()) {
+          break;
+        }
+        node_id = child(node_id, MIDDLE);
+      }
+    }
+    if (node_id == 0) {
+      return;
+    }
+  }
+  cursor.key_.assign(prefix.substr(0, key_length));
+  cursor.stack_.push_back(Cursor::Frame{ node_id, key_length, Cursor::MIDDLE });
+}
+
+bool BlockedTSTree::PrefixCursor::next() {
+  while (node_id_ != (uint64_t)-1) {
+    uint64_t node_id = node_id_;
+    length_ = pos_;
+    // Move on to the middle descendant which matches the query, if any.
+    node_id_ = -1;
+    if (pos_ < query_.length()) {
+      uint8_t byte = query_[pos_];
+      uint64_t child_id = trie_->child(node_id, MIDDLE);
+      while (child_id != 0 && byte != trie_->label(child_id)) {
+        if (byte < trie_->label(child_id)) {
+          child_id = trie_->child(child_id, LO);
+        } else {
+          child_id = trie_->child(child_id, HI);
+        }
+      }
+      if (child_id != 0) {
+        ++pos_;
+        if (trie_->link(child_id)) {
+          uint64_t tail_pos = trie_->tail_pos(child_id);
+          do {
+            if (pos_ == query_.length() ||
+                trie_->tail_bytes_[tail_pos] != (uint8_t)query_[pos_]) {
+              child_id = 0;
+              break;
+            }
+            ++pos_;
+          } while (!trie_->tail_bits_[++tail_pos]);
+        }
+        if (child_id != 0) {
+          node_id_ = child_id;
+        }
+      }
+    }
+    if (trie_->outs_[node_id]) {
+      id_ = trie_->outs_.rank1(node_id);
+      return true;
+    }
+  }
+  return false;
+}
+
+void BlockedTSTree::common_prefix_search(string_view query,
+  PrefixCursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.query_ = query;
+  cursor.node_id_ = 0;
+  cursor.pos_ = 0;
+  cursor.length_ = 0;
+  cursor.id_ = -1;
+}
+
+bool BlockedTSTree::save(const char *path) const {
+  Writer writer;
+  if (!writer.open(path)) {
+    return false;
+  }
+  writer.write_header(name());
+  blocks_.write(writer);
+  root_nodes_.write(writer);
+  roots_.write(writer);
+  parents_.write(writer);
+  outs_.write(writer);
+  links_.write(writer);
+  tail_bits_.write(writer);
+  tail_bytes_.write(writer);
+  writer.write(n_keys_);
+  writer.write(n_nodes_);
+  writer.write(size_);
+  writer.write(flags_);
+  return writer.close();
+}
+
+bool BlockedTSTree::map(const char *path) {
+  Mapper mapper;
+  if (!mapper.open(path) || !mapper.map_header(name())) {
+    return false;
+  }
+  // The file is mapped into a new trie, so that this one is kept if the
+  // file is broken.
+  BlockedTSTree trie;
+  trie.blocks_.map(mapper);
+  trie.root_nodes_.map(mapper);
+  trie.roots_.map(mapper);
+  trie.parents_.map(mapper);
+  trie.outs_.map(mapper);
+  trie.links_.map(mapper);
+  trie.tail_bits_.map(mapper);
+  trie.tail_bytes_.map(mapper);
+  mapper.map(trie.n_keys_);
+  mapper.map(trie.n_nodes_);
+  mapper.map(trie.size_);
+  mapper.map(trie.flags_);
+  if (!mapper.ok()) {
+    return false;
+  }
+  trie.mapper_ = move(mapper);
+  *this = move(trie);
+  return true;
+}
+
+}  // namespace trie_eval
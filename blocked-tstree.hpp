@@ -0,0 +1,270 @@
+#ifndef BLOCKED_TSTREE_HPP
+#define BLOCKED_TSTREE_HPP
+
+#include "bit-vector.hpp"
+#include "compressed-bit-vector.hpp"
+#include "int-vector.hpp"
+#include "select-in-word.hpp"
+#include "trie-base.hpp"
+#include "tstree.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// BlockedTSTree is TSTree with its nodes packed into cache-line blocks, so
+// that the steps of a lookup inside a block take no rank and no access to
+// another line. A block has the top of a subtree in level order, or small
+// subtrees as a whole, and a child which does not fit is the root of
+// another block. The ID of a node is BLOCK_SIZE * block_id + slot.
+class BlockedTSTree : TrieBase {
+ public:
+  static constexpr uint64_t BLOCK_SIZE = 34;
+
+  explicit BlockedTSTree(uint64_t flags = 0);
+  ~BlockedTSTree() {}
+
+  BlockedTSTree(BlockedTSTree &&) = default;
+  BlockedTSTree &operator=(BlockedTSTree &&) = default;
+
+  // Builder builds a TSTree from keys given one at a time in sorted order
+  // and then packs its nodes.
+  class Builder {
+   public:
+    explicit Builder(BlockedTSTree &trie)
+      : trie_(trie), tree_(), builder_(tree_) {}
+
+    void add(string_view key, uint64_t weight = 0) {
+      builder_.add(key, weight);
+    }
+    void finish();
+
+   private:
+    BlockedTSTree &trie_;
+    TSTree tree_;
+    TSTree::Builder builder_;
+  };
+
+  void build(const vector<string> &keys);
+  void build(const vector<string> &keys, uint64_t n_threads);
+  // build() with weights shapes the tree as TSTree::build() does.
+  void build(const vector<string> &keys, span<const uint64_t> weights,
+    uint64_t n_threads = 1);
+
+  uint64_t lookup(const string &query) const;
+  void reverse_lookup(uint64_t id, string &key) const;
+
+  // reverse_lookup_batch() is that of TrieBase, as a parent outside the
+  // block takes two more dependent accesses than a lookup step.
+  void lookup_batch(span<const string_view> queries,
+    span<uint64_t> ids) const;
+  using TrieBase::reverse_lookup_batch;
+
+  // Cursor enumerates keys in lexicographic order. key() is a buffer which
+  // is reused by next(), so no string is allocated per key.
+  class Cursor {
+   public:
+    Cursor() : trie_(nullptr), stack_(), key_(), id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    const string &key() const {
+      return key_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class BlockedTSTree;
+
+    // A node is visited in three steps: its lo subtree, the node itself
+    // followed by its middle subtree, and its hi subtree.
+    enum Step {
+      LO,
+      MIDDLE,
+      HI,
+    };
+
+    struct Frame {
+      uint64_t node_id;
+      uint64_t key_length;
+      Step step;
+    };
+
+    const BlockedTSTree *trie_;
+    vector<Frame> stack_;
+    string key_;
+    uint64_t id_;
+  };
+
+  // predictive_search() sets cursor to the keys which start with prefix.
+  void predictive_search(string_view prefix, Cursor &cursor) const;
+
+  // PrefixCursor enumerates the keys which are prefixes of a query in order
+  // of length.
+  class PrefixCursor {
+   public:
+    PrefixCursor()
+      : trie_(nullptr), query_(), node_id_(-1), pos_(0), length_(0),
+        id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    // The key is the first length() bytes of the query.
+    uint64_t length() const {
+      return length_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class BlockedTSTree;
+
+    const BlockedTSTree *trie_;
+    string_view query_;
+    // node_id_ is the next node to visit and the first pos_ bytes of the
+    // query are its key.
+    uint64_t node_id_;
+    uint64_t pos_;
+    uint64_t length_;
+    uint64_t id_;
+  };
+
+  // common_prefix_search() sets cursor to the keys which are prefixes of
+  // query.
+  void common_prefix_search(string_view query, PrefixCursor &cursor) const;
+
+  bool save(const char *path) const;
+  bool map(const char *path);
+
+  const char *name() const {
+    return "Ternary search tree + blocks";
+  }
+  uint64_t n_keys() const {
+    return n_keys_;
+  }
+  uint64_t n_nodes() const {
+    return n_nodes_;
+  }
+  uint64_t size() const {
+    return size_;
+  }
+  uint64_t flags() const {
+    return flags_;
+  }
+
+ private:
+  enum Kind : uint64_t {
+    LO,
+    MIDDLE,
+    HI,
+  };
+
+  // Block has up to BLOCK_SIZE nodes. The first n_roots are roots and the
+  // others follow in level order, so the children of a slot come after
+  // those of the slots before it and a child is found by popcount. The
+  // children past n_nodes are roots whose IDs are in root_nodes_ from
+  // first_root.
+  struct alignas(64) Block {
+    // children has the lo, middle and hi bits of each slot.
+    uint64_t children[2];
+    // links tells if the node of a slot has a tail.
+    uint64_t links;
+    uint32_t first_root;
+    uint8_t n_roots;
+    uint8_t n_nodes;
+    uint8_t labels[BLOCK_SIZE];
+
+    // child() returns the index of the kind-th child of slot, which is
+    // n_nodes or more if it is out of the block, or -1 if there is none.
+    uint64_t child(uint64_t slot, uint64_t kind) const {
+      uint64_t pos = (slot * 3) + kind;
+      uint64_t word = children[pos / 64];
+      if (((word >> (pos % 64)) & 1) == 0) {
+        return -1;
+      }
+      uint64_t rank = __builtin_popcountll(word & ((1UL << (pos % 64)) - 1));
+      if (pos >= 64) {
+        rank += __builtin_popcountll(children[0]);
+      }
+      return n_roots + rank;
+    }
+    // parent() returns the slot * 3 + kind of the parent of a slot which is
+    // not a root.
+    uint64_t parent(uint64_t slot) const {
+      uint64_t rank = slot - n_roots;
+      uint64_t n_ones = __builtin_popcountll(children[0]);
+      if (rank < n_ones) {
+        return select_in_word(children[0], rank);
+      }
+      return 64 + select_in_word(children[1], rank - n_ones);
+    }
+  };
+  static_assert(sizeof(Block) == 64);
+
+  Vector<Block> blocks_;
+  IntVector root_nodes_;
+  // roots_ has a 1 at each root and parents_ has the parent of each in
+  // order, as parent_id * 3 + kind.
+  BitVector roots_;
+  IntVector parents_;
+  CompressedBitVector outs_;
+  CompressedBitVector links_;
+  BitVector tail_bits_;
+  Vector<uint8_t> tail_bytes_;
+  uint64_t n_keys_;
+  uint64_t n_nodes_;
+  uint64_t size_;
+  uint64_t flags_;
+  Mapper mapper_;
+
+  void build(const TSTree &tree);
+
+  const Block &block(uint64_t node_id) const {
+    return blocks_[node_id / BLOCK_SIZE];
+  }
+  uint8_t label(uint64_t node_id) const {
+    return block(node_id).labels[node_id % BLOCK_SIZE];
+  }
+  bool link(uint64_t node_id) const {
+    return (block(node_id).links >> (node_id % BLOCK_SIZE)) & 1;
+  }
+  // child() returns the ID of the kind-th child of node_id or 0 if there is
+  // none.
+  uint64_t child(uint64_t node_id, uint64_t kind) const {
+    const Block &block = this->block(node_id);
+    uint64_t index = block.child(node_id % BLOCK_SIZE, kind);
+    if (index == (uint64_t)-1) {
+      return 0;
+    } else if (index < block.n_nodes) {
+      return node_id - (node_id % BLOCK_SIZE) + index;
+    }
+    return root_nodes_[block.first_root + (index - block.n_nodes)];
+  }
+  // parent() returns the ID of the parent of node_id and sets kind.
+  uint64_t parent(uint64_t node_id, uint64_t &kind) const {
+    const Block &block = this->block(node_id);
+    uint64_t slot = node_id % BLOCK_SIZE;
+    uint64_t parent_pos;
+    if (slot < block.n_roots) {
+      parent_pos = parents_[roots_.rank1(node_id)];
+      kind = parent_pos % 3;
+      return parent_pos / 3;
+    }
+    parent_pos = block.parent(slot);
+    kind = parent_pos % 3;
+    return node_id - slot + (parent_pos / 3);
+  }
+  // tail_pos() returns the position of the tail of node_id.
+  uint64_t tail_pos(uint64_t node_id) const {
+    return tail_bits_.select1(links_.rank1(node_id));
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // BLOCKED_TSTREE_HPP
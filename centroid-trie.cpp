@@ -0,0 +1,567 @@
+#include "centroid-trie.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "batch.hpp"
+#include "parallel.hpp"
+
+namespace trie_eval {
+namespace {
+
+// The paths of a level are decomposed in chunks of this many nodes.
+const uint64_t CHUNK_SIZE = 1024;
+
+// Range is a node of the decomposed tree: keys[begin, end), which share
+// their first depth bytes, and the branch of the node in its parent.
+struct Range {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t depth;
+  uint64_t branch;
+};
+
+// Paths has the labels and the children of a chunk of a level.
+struct Paths {
+  string labels;
+  vector<uint64_t> label_lengths;
+  vector<uint64_t> n_children;
+  vector<Range> children;
+};
+
+struct LookupState {
+  string_view query;
+  uint64_t *id;
+  uint64_t i;
+  uint64_t node_id;
+  uint64_t node_pos;
+  uint64_t label_pos;
+  bool done;
+};
+
+struct ReverseLookupState {
+  string *key;
+  uint64_t node_id;
+  uint64_t label_pos;
+  // length is how much of the label of node_id is in the key.
+  uint64_t length;
+  bool done;
+};
+
+// code() returns the code of the i-th byte of key, or 0 at its end.
+uint64_t code(string_view key, uint64_t i) {
+  return (i < key.length()) ? ((uint8_t)key[i] + 1) : 0;
+}
+
+// match() returns the length of the common prefix of label and query[i:],
+// comparing 8 bytes at a time.
+uint64_t match(string_view label, string_view query, uint64_t i) {
+  uint64_t n = min(label.length(), query.length() - i);
+  const char *lhs = label.data();
+  const char *rhs = query.data() + i;
+  uint64_t pos = 0;
+  for ( ; pos + 8 <= n; pos += 8) {
+    uint64_t lhs_word, rhs_word;
+    memcpy(&lhs_word, lhs + pos, 8);
+    memcpy(&rhs_word, rhs + pos, 8);
+    if (lhs_word != rhs_word) {
+      return pos + (__builtin_ctzll(lhs_word ^ rhs_word) / 8);
+    }
+  }
+  while (pos < n && lhs[pos] == rhs[pos]) {
+    ++pos;
+  }
+  return pos;
+}
+
+// decompose() appends the label of the path of range to paths and the
+// ranges which branch off it to paths.children in order of branches. The
+// path goes through the largest group of keys at each branch, the first
+// of them if there is a tie.
+void decompose(const vector<string> &keys, const Range &range,
+  uint64_t code_bits, Paths &paths) {
+  uint64_t begin = range.begin;
+  uint64_t end = range.end;
+  uint64_t depth = range.depth;
+  uint64_t n_children = paths.children.size();
+  uint64_t n_bytes = paths.labels.size();
+  while (end - begin > 1) {
+    // The keys share the bytes up to where the first and the last differ.
+    const string &first = keys[begin];
+    const string &last = keys[end - 1];
+    uint64_t length = depth + match(string_view(first).substr(depth),
+      last, depth);
+    paths.labels.append(first, depth, length - depth);
+    depth = length;
+
+    uint64_t pos = depth - range.depth;
+    uint64_t heavy_id = 0;
+    uint64_t heavy_size = 0;
+    for (uint64_t i = begin; i < end; ) {
+      uint64_t code = trie_eval::code(keys[i], depth);
+      uint64_t j = i + 1;
+      if (code != 0) {
+        j = partition_point(keys.begin() + j, keys.begin() + end,
+          [&](const string &key) {
+            return (uint8_t)key[depth] + 1U <= code;
+          }) - keys.begin();
+      }
+      if (j - i > heavy_size) {
+        heavy_id = paths.children.size();
+        heavy_size = j - i;
+      }
+      paths.children.push_back(Range{ i, j, depth + (code != 0),
+        (pos << code_bits) | code });
+      i = j;
+    }
+    Range heavy = paths.children[heavy_id];
+    paths.children.erase(paths.children.begin() + heavy_id);
+    begin = heavy.begin;
+    end = heavy.end;
+    if (heavy.depth != depth) {
+      paths.labels.push_back(keys[begin][depth]);
+      depth = heavy.depth;
+    }
+  }
+  paths.labels.append(keys[begin], depth);
+  paths.label_lengths.push_back(paths.labels.size() - n_bytes);
+  paths.n_children.push_back(paths.children.size() - n_children);
+}
+
+}  // namespace
+
+CentroidTrie::CentroidTrie(uint64_t flags)
+  : louds_(), branches_(), label_bits_(), labels_(), n_keys_(0), size_(0),
+    flags_(flags), mapper_() {}
+
+void CentroidTrie::build(const vector<string> &keys) {
+  build(keys, 1);
+}
+
+// build() decomposes the tree level by level, so that node IDs are in level
+// order as LOUDS needs. The paths of a level are independent and are
+// decomposed in chunks on threads, and then the chunks are appended in
+// order.
+void CentroidTrie::build(const vector<string> &keys, uint64_t n_threads) {
+  uint64_t bv_flags = 0;
+  if (flags_ & TRIE_INTERLEAVED) {
+    bv_flags |= BitVector::INTERLEAVED;
+  }
+
+  louds_ = BitVector();
+  label_bits_ = BitVector();
+  labels_.clear();
+  vector<uint64_t> branches;
+  uint64_t max_branch = 0;
+  vector<Range> level;
+  if (!keys.empty()) {
+    level.push_back(Range{ 0, keys.size(), 0, 0 });
+    louds_.add(0);
+  }
+  louds_.add(1);
+  while (!level.empty()) {
+    vector<Paths> chunks((level.size() + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    parallel(n_threads, chunks.size(), [&](uint64_t chunk_id) {
+      uint64_t begin = chunk_id * CHUNK_SIZE;
+      uint64_t end = min(begin + CHUNK_SIZE, (uint64_t)level.size());
+      for (uint64_t i = begin; i < end; ++i) {
+        decompose(keys, level[i], CODE_BITS, chunks[chunk_id]);
+      }
+    });
+    for (const Range &range : level) {
+      branches.push_back(range.branch);
+      max_branch = max(max_branch, range.branch);
+    }
+    vector<Range> next_level;
+    for (const Paths &paths : chunks) {
+      for (uint64_t i = 0; i < paths.label_lengths.size(); ++i) {
+        louds_.append_run(0, paths.n_children[i]);
+        louds_.add(1);
+        label_bits_.add(1);
+        label_bits_.append_run(0, paths.label_lengths[i]);
+      }
+      uint64_t n_bytes = labels_.size();
+      labels_.resize(n_bytes + paths.labels.size());
+      for (uint64_t i = 0; i < paths.labels.size(); ++i) {
+        labels_[n_bytes + i] = paths.labels[i];
+      }
+      next_level.insert(next_level.end(), paths.children.begin(),
+        paths.children.end());
+    }
+    level.swap(next_level);
+  }
+  label_bits_.add(1);
+
+  louds_.build(bv_flags | BitVector::SELECT0 | BitVector::SELECT1,
+    n_threads);
+  label_bits_.build(bv_flags | BitVector::SELECT1, n_threads);
+  branches_.init(branches.size(), max_branch);
+  for (uint64_t i = 0; i < branches.size(); ++i) {
+    branches_.set(i, branches[i]);
+  }
+
+  n_keys_ = keys.size();
+  size_ = louds_.size();
+  size_ += branches_.size();
+  size_ += label_bits_.size();
+  size_ += labels_.size();
+}
+
+uint64_t CentroidTrie::lookup(const string &query) const {
+  if (n_keys_ == 0) {
+    return -1;
+  }
+  uint64_t node_id = 0;
+  for (uint64_t i = 0; ; ) {
+    string_view label = this->label(node_id);
+    uint64_t pos = match(label, query, i);
+    if (pos == label.length() && i + pos == query.length()) {
+      return node_id;
+    }
+    // The query leaves the path at pos, to a child or out of the trie.
+    uint64_t code = trie_eval::code(query, i + pos);
+    node_id = find_child(node_id, (pos << CODE_BITS) | code);
+    if (node_id == (uint64_t)-1) {
+      return -1;
+    }
+    i += pos + (code != 0);
+  }
+}
+
+// reverse_lookup() goes up from the node of id. A node adds the part of its
+// label above the branch of the child it is reached from, and the first
+// byte of the child.
+void CentroidTrie::reverse_lookup(uint64_t id, string &key) const {
+  assert(id < n_keys());
+  key.clear();
+  uint64_t node_id = id;
+  uint64_t length = -1;
+  for ( ; ; ) {
+    string_view label = this->label(node_id).substr(0, length);
+    key.append(label.rbegin(), label.rend());
+    if (node_id == 0) {
+      break;
+    }
+    uint64_t branch = branches_[node_id];
+    if ((branch & CODE_MASK) != 0) {
+      key.push_back((branch & CODE_MASK) - 1);
+    }
+    length = branch >> CODE_BITS;
+    uint64_t node_pos = louds_.select0(node_id);
+    node_id = node_pos - node_id - 1;
+  }
+  reverse(key.begin(), key.end());
+}
+
+void CentroidTrie::lookup_batch(span<const string_view> queries,
+  span<uint64_t> ids) const {
+  assert(queries.size() == ids.size());
+  interleave<LookupState>(queries.size(),
+    [&](LookupState &state, uint64_t i) {
+      state.query = queries[i];
+      state.id = &ids[i];
+      if (n_keys_ == 0) {
+        *state.id = -1;
+        return false;
+      }
+      state.i = 0;
+      state.node_id = 0;
+      return true;
+    },
+    // A round matches the label of each node and moves on to the child at
+    // which the query leaves it. The label and the children are found by
+    // two selects, whose samples and blocks are prefetched for all the
+    // states first.
+    [&](LookupState *states, uint64_t n_states) {
+      for (uint64_t j = 0; j < n_states; ++j) {
+        label_bits_.prefetch_select1_sample(states[j].node_id);
+        louds_.prefetch_select1_sample(states[j].node_id);
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        label_bits_.prefetch_select1_block(states[j].node_id);
+        louds_.prefetch_select1_block(states[j].node_id);
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        state.label_pos = label_bits_.select1(state.node_id) + 1;
+        label_bits_.prefetch(state.label_pos);
+        __builtin_prefetch(
+          labels_.data() + (state.label_pos - state.node_id - 1));
+        state.node_pos = louds_.select1(state.node_id) + 1;
+        louds_.prefetch(state.node_pos);
+        branches_.prefetch(state.node_pos - state.node_id - 1);
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        string_view label = label_at(state.node_id, state.label_pos);
+        uint64_t pos = match(label, state.query, state.i);
+        if (pos == label.length() && state.i + pos == state.query.length()) {
+          *state.id = state.node_id;
+          state.done = true;
+          continue;
+        }
+        uint64_t end = louds_.next1(state.node_pos);
+        uint64_t begin = state.node_pos - state.node_id - 1;
+        end = begin + end - state.node_pos;
+        uint64_t code = trie_eval::code(state.query, state.i + pos);
+        state.node_id = find_branch(begin, end, (pos << CODE_BITS) | code);
+        if (state.node_id == (uint64_t)-1) {
+          *state.id = -1;
+          state.done = true;
+        } else {
+          state.i += pos + (code != 0);
+        }
+      }
+    });
+}
+
+void CentroidTrie::reverse_lookup_batch(span<const uint64_t> ids,
+  span<string> keys) const {
+  assert(ids.size() == keys.size());
+  interleave<ReverseLookupState>(ids.size(),
+    [&](ReverseLookupState &state, uint64_t i) {
+      assert(ids[i] < n_keys());
+      state.key = &keys[i];
+      state.key->clear();
+      state.node_id = ids[i];
+      state.length = -1;
+      return true;
+    },
+    // A round adds the label of each node, as reverse_lookup() does, and
+    // moves up to its parent.
+    [&](ReverseLookupState *states, uint64_t n_states) {
+      for (uint64_t j = 0; j < n_states; ++j) {
+        const ReverseLookupState &state = states[j];
+        label_bits_.prefetch_select1_sample(state.node_id);
+        louds_.prefetch_select0_sample(state.node_id);
+        branches_.prefetch(state.node_id);
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        const ReverseLookupState &state = states[j];
+        label_bits_.prefetch_select1_block(state.node_id);
+        louds_.prefetch_select0_block(state.node_id);
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        state.label_pos = label_bits_.select1(state.node_id) + 1;
+        label_bits_.prefetch(state.label_pos);
+        __builtin_prefetch(
+          labels_.data() + (state.label_pos - state.node_id - 1));
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        string_view label =
+          label_at(state.node_id, state.label_pos).substr(0, state.length);
+        state.key->append(label.rbegin(), label.rend());
+        if (state.node_id == 0) {
+          reverse(state.key->begin(), state.key->end());
+          state.done = true;
+          continue;
+        }
+        uint64_t branch = branches_[state.node_id];
+        if ((branch & CODE_MASK) != 0) {
+          state.key->push_back((branch & CODE_MASK) - 1);
+        }
+        state.length = branch >> CODE_BITS;
+        uint64_t node_pos = louds_.select0(state.node_id);
+        state.node_id = node_pos - state.node_id - 1;
+      }
+    });
+}
+
+bool CentroidTrie::Cursor::next() {
+  while (!stack_.empty()) {
+    Frame &frame = stack_.back();
+    uint64_t child_id = -1;
+    if (frame.step == LESS) {
+      for ( ; frame.next < frame.end; ++frame.next) {
+        uint64_t branch = trie_->branches_[frame.next];
+        uint64_t pos = branch >> CODE_BITS;
+        if ((branch & CODE_MASK) < code(frame.label, pos)) {
+          child_id = frame.next++;
+          break;
+        }
+      }
+      if (child_id == (uint64_t)-1) {
+        // The key of the node comes after the children less than it.
+        key_.resize(frame.key_length);
+        key_.append(frame.label);
+        id_ = frame.node_id;
+        frame.step = GREATER;
+        frame.next = frame.end;
+        frame.group_begin = frame.end;
+        frame.group_end = frame.end;
+        return true;
+      }
+    } else {
+      if (frame.next == frame.group_end) {
+        if (frame.group_begin == frame.begin) {
+          stack_.pop_back();
+          continue;
+        }
+        // Move on to the children at the previous position.
+        frame.group_end = frame.group_begin;
+        uint64_t pos = trie_->branches_[frame.group_end - 1] >> CODE_BITS;
+        do {
+          --frame.group_begin;
+        } while (frame.group_begin != frame.begin &&
+          (trie_->branches_[frame.group_begin - 1] >> CODE_BITS) == pos);
+        frame.next = frame.group_begin;
+      }
+      uint64_t branch = trie_->branches_[frame.next];
+      uint64_t pos = branch >> CODE_BITS;
+      if ((branch & CODE_MASK) > code(frame.label, pos)) {
+        child_id = frame.next;
+      }
+      ++frame.next;
+      if (child_id == (uint64_t)-1) {
+        continue;
+      }
+    }
+    uint64_t branch = trie_->branches_[child_id];
+    key_.resize(frame.key_length);
+    key_.append(frame.label.substr(0, branch >> CODE_BITS));
+    if ((branch & CODE_MASK) != 0) {
+      key_.push_back((branch & CODE_MASK) - 1);
+    }
+    push(child_id, key_.length(), 0);
+  }
+  return false;
+}
+
+void CentroidTrie::Cursor::push(uint64_t node_id, uint64_t key_length,
+  uint64_t min_pos) {
+  uint64_t begin, end;
+  trie_->children(node_id, begin, end);
+  begin = trie_->lower_branch(begin, end, min_pos << CODE_BITS);
+  stack_.push_back(Frame{ node_id, trie_->label(node_id), key_length, begin,
+    end, begin, begin, begin, LESS });
+}
+
+void CentroidTrie::predictive_search(string_view prefix,
+  Cursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.stack_.clear();
+  cursor.key_.clear();
+  cursor.id_ = -1;
+  if (n_keys_ == 0) {
+    return;
+  }
+  uint64_t node_id = 0;
+  for (uint64_t i = 0; ; ) {
+    string_view label = this->label(node_id);
+    uint64_t pos = match(label, prefix, i);
+    if (i + pos == prefix.length()) {
+      // The prefix ends at pos in the label, and the children which
+      // branch off before it do not start with the prefix.
+      cursor.key_.assign(prefix.substr(0, i));
+      cursor.push(node_id, i, pos);
+      return;
+    }
+    uint64_t branch = (pos << CODE_BITS) | code(prefix, i + pos);
+    node_id = find_child(node_id, branch);
+    if (node_id == (uint64_t)-1) {
+      return;
+    }
+    i += pos + 1;
+  }
+}
+
+bool CentroidTrie::PrefixCursor::next() {
+  while (node_id_ != (uint64_t)-1) {
+    if (match_ == (uint64_t)-1) {
+      string_view label = trie_->label(node_id_);
+      match_ = match(label, query_, pos_);
+      label_length_ = label.length();
+      trie_->children(node_id_, child_id_, child_end_);
+    }
+    // Keys which end on the path are children of code 0, which come first
+    // at their positions, so the other children at a position are skipped
+    // by a search for the next one. The scan stops at the position where
+    // the query leaves the path.
+    while (child_id_ != child_end_) {
+      uint64_t branch = trie_->branches_[child_id_];
+      uint64_t pos = branch >> CODE_BITS;
+      if (pos > match_ || (pos == match_ && (branch & CODE_MASK) != 0)) {
+        break;
+      }
+      if ((branch & CODE_MASK) == 0) {
+        length_ = pos_ + pos;
+        id_ = child_id_++;
+        return true;
+      }
+      child_id_ = trie_->lower_branch(child_id_ + 1, child_end_,
+        (pos + 1) << CODE_BITS);
+    }
+    // Then comes the key of the node, if the query goes through its label,
+    // and the keys of the child at which the query leaves the path.
+    uint64_t node_id = node_id_;
+    uint64_t length = pos_ + match_;
+    bool hit = match_ == label_length_;
+    node_id_ = -1;
+    if (length < query_.length()) {
+      node_id_ = trie_->find_branch(child_id_, child_end_,
+        (match_ << CODE_BITS) | code(query_, length));
+      pos_ = length + 1;
+    }
+    match_ = -1;
+    if (hit) {
+      length_ = length;
+      id_ = node_id;
+      return true;
+    }
+  }
+  return false;
+}
+
+void CentroidTrie::common_prefix_search(string_view query,
+  PrefixCursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.query_ = query;
+  cursor.node_id_ = (n_keys_ != 0) ? 0 : -1;
+  cursor.pos_ = 0;
+  cursor.match_ = -1;
+  cursor.length_ = 0;
+  cursor.id_ = -1;
+}
+
+bool CentroidTrie::save(const char *path) const {
+  Writer writer;
+  if (!writer.open(path)) {
+    return false;
+  }
+  writer.write_header(name());
+  louds_.write(writer);
+  branches_.write(writer);
+  label_bits_.write(writer);
+  labels_.write(writer);
+  writer.write(n_keys_);
+  writer.write(size_);
+  writer.write(flags_);
+  return writer.close();
+}
+
+bool CentroidTrie::map(const char *path) {
+  Mapper mapper;
+  if (!mapper.open(path) || !mapper.map_header(name())) {
+    return false;
+  }
+  // The file is mapped into a new trie, so that this one is kept if the
+  // file is broken.
+  CentroidTrie trie;
+  trie.louds_.map(mapper);
+  trie.branches_.map(mapper);
+  trie.label_bits_.map(mapper);
+  trie.labels_.map(mapper);
+  mapper.map(trie.n_keys_);
+  mapper.map(trie.size_);
+  mapper.map(trie.flags_);
+  if (!mapper.ok()) {
+    return false;
+  }
+  trie.mapper_ = move(mapper);
+  *this = move(trie);
+  return true;
+}
+
+}  // namespace trie_eval
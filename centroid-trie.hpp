@@ -0,0 +1,224 @@
+#ifndef CENTROID_TRIE_HPP
+#define CENTROID_TRIE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bit-vector.hpp"
+#include "int-vector.hpp"
+#include "trie-base.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// CentroidTrie is a centroid path decomposition of a trie. The root path
+// goes from the root down through the child with the most keys at each
+// node and ends at a key, and the subtrees which hang off it are
+// decomposed in the same way as the children of the path. A node of the
+// decomposed tree is such a path, whose label is its bytes, and its key is
+// the one at its end, so the ID of a key is its node. A child subtree has
+// at most half of the keys of its parent, so a lookup visits O(log n)
+// nodes however deep the trie is.
+class CentroidTrie : TrieBase {
+ public:
+  explicit CentroidTrie(uint64_t flags = 0);
+  ~CentroidTrie() {}
+
+  CentroidTrie(CentroidTrie &&) = default;
+  CentroidTrie &operator=(CentroidTrie &&) = default;
+
+  void build(const vector<string> &keys);
+  // build() with n_threads decomposes the paths of a level on up to
+  // n_threads threads. The trie is the same as with one.
+  void build(const vector<string> &keys, uint64_t n_threads);
+
+  uint64_t lookup(const string &query) const;
+  void reverse_lookup(uint64_t id, string &key) const;
+
+  void lookup_batch(span<const string_view> queries,
+    span<uint64_t> ids) const;
+  void reverse_lookup_batch(span<const uint64_t> ids,
+    span<string> keys) const;
+
+  // Cursor enumerates keys in lexicographic order. key() is a buffer which
+  // is reused by next(), so no string is allocated per key.
+  class Cursor {
+   public:
+    Cursor() : trie_(nullptr), stack_(), key_(), id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    const string &key() const {
+      return key_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class CentroidTrie;
+
+    // The children of a node whose first bytes are less than those of its
+    // path come first, in order of position, then its key, and then the
+    // others in reverse order of position.
+    enum Step {
+      LESS,
+      GREATER,
+    };
+
+    // A frame visits the children [begin, end) of a node. In GREATER,
+    // [group_begin, group_end) are the children at one position.
+    struct Frame {
+      uint64_t node_id;
+      string_view label;
+      uint64_t key_length;
+      uint64_t begin;
+      uint64_t end;
+      uint64_t next;
+      uint64_t group_begin;
+      uint64_t group_end;
+      Step step;
+    };
+
+    const CentroidTrie *trie_;
+    vector<Frame> stack_;
+    string key_;
+    uint64_t id_;
+
+    // push() adds a frame for node_id which skips the children before
+    // min_pos in its label.
+    void push(uint64_t node_id, uint64_t key_length, uint64_t min_pos);
+  };
+
+  // predictive_search() sets cursor to the keys which start with prefix.
+  void predictive_search(string_view prefix, Cursor &cursor) const;
+
+  // PrefixCursor enumerates the keys which are prefixes of a query in order
+  // of length.
+  class PrefixCursor {
+   public:
+    PrefixCursor()
+      : trie_(nullptr), query_(), node_id_(-1), pos_(0), match_(-1),
+        label_length_(0), child_id_(0), child_end_(0), length_(0),
+        id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    // The key is the first length() bytes of the query.
+    uint64_t length() const {
+      return length_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class CentroidTrie;
+
+    const CentroidTrie *trie_;
+    string_view query_;
+    // node_id_ is the node to visit and the first pos_ bytes of the query
+    // lead to it. Once it is entered, match_ bytes of its label match the
+    // query and [child_id_, child_end_) are the children to check for a key
+    // which ends on the path.
+    uint64_t node_id_;
+    uint64_t pos_;
+    uint64_t match_;
+    uint64_t label_length_;
+    uint64_t child_id_;
+    uint64_t child_end_;
+    uint64_t length_;
+    uint64_t id_;
+  };
+
+  // common_prefix_search() sets cursor to the keys which are prefixes of
+  // query.
+  void common_prefix_search(string_view query, PrefixCursor &cursor) const;
+
+  bool save(const char *path) const;
+  bool map(const char *path);
+
+  const char *name() const {
+    return "Centroid path-decomposed trie";
+  }
+  uint64_t n_keys() const {
+    return n_keys_;
+  }
+  uint64_t size() const {
+    return size_;
+  }
+  uint64_t flags() const {
+    return flags_;
+  }
+
+ private:
+  // A branch is pos << CODE_BITS | code, where pos is the position in the
+  // label of the parent at which a child branches off and code is its
+  // first byte + 1, or 0 if its key ends there. The children of a node are
+  // in order of branches.
+  static constexpr uint64_t CODE_BITS = 9;
+  static constexpr uint64_t CODE_MASK = (1 << CODE_BITS) - 1;
+
+  // louds_ is the LOUDS of the decomposed tree. label_bits_ has a 1 and as
+  // many 0s as bytes for each label, followed by a 1.
+  BitVector louds_;
+  IntVector branches_;
+  BitVector label_bits_;
+  Vector<uint8_t> labels_;
+  uint64_t n_keys_;
+  uint64_t size_;
+  uint64_t flags_;
+  Mapper mapper_;
+
+  // children() sets [begin, end) to the IDs of the children of node_id.
+  void children(uint64_t node_id, uint64_t &begin, uint64_t &end) const {
+    uint64_t node_pos = louds_.select1(node_id) + 1;
+    end = louds_.next1(node_pos);
+    begin = node_pos - node_id - 1;
+    end = begin + end - node_pos;
+  }
+  // find_child() returns the child of node_id by branch or -1.
+  uint64_t find_child(uint64_t node_id, uint64_t branch) const {
+    uint64_t begin, end;
+    children(node_id, begin, end);
+    return find_branch(begin, end, branch);
+  }
+  // find_branch() returns the child in [begin, end) by branch or -1.
+  uint64_t find_branch(uint64_t begin, uint64_t end, uint64_t branch) const {
+    uint64_t child_id = lower_branch(begin, end, branch);
+    return (child_id != end && branches_[child_id] == branch) ? child_id : -1;
+  }
+  // lower_branch() returns the first child in [begin, end) whose branch is
+  // not less than branch.
+  uint64_t lower_branch(uint64_t begin, uint64_t end, uint64_t branch) const {
+    while (begin < end) {
+      uint64_t child_id = (begin + end) / 2;
+      if (branch > branches_[child_id]) {
+        begin = child_id + 1;
+      } else {
+        end = child_id;
+      }
+    }
+    return begin;
+  }
+  // label() returns the label of node_id.
+  string_view label(uint64_t node_id) const {
+    uint64_t pos = label_bits_.select1(node_id) + 1;
+    return label_at(node_id, pos);
+  }
+  // label_at() returns the label of node_id, which starts at pos in
+  // label_bits_.
+  string_view label_at(uint64_t node_id, uint64_t pos) const {
+    uint64_t length = label_bits_.next1(pos) - pos;
+    return string_view(reinterpret_cast<const char *>(labels_.data()) +
+      (pos - node_id - 1), length);
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // CENTROID_TRIE_HPP
@@ -0,0 +1,165 @@
+#ifndef COMPRESSED_BIT_VECTOR_HPP
+#define COMPRESSED_BIT_VECTOR_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "bit-vector.hpp"
+#include "elias-fano.hpp"
+#include "rrr-vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// CompressedBitVector is a BitVector which build() with COMPRESSED encodes
+// with Elias-Fano or RRR if either is smaller than the plain bits with
+// their indexes, which are then dropped. Elias-Fano wins for sparse bits
+// and RRR for skewed bits of medium density. Bits are added and set as in
+// a BitVector, but only operator[], rank1(), select1() and their prefetch
+// helpers may be used after build(). The encodings are slower, so this is
+// for members which are not on the path of every step. The BitVector is
+// a private base, so that what an encoding drops cannot be reached through
+// it.
+struct CompressedBitVector : private BitVector {
+  enum Encoding : uint64_t {
+    PLAIN,
+    ELIAS_FANO,
+    RRR,
+  };
+
+  Encoding encoding;
+  EliasFano elias_fano;
+  RrrVector rrr;
+
+  CompressedBitVector()
+    : BitVector(), encoding(PLAIN), elias_fano(), rrr() {}
+  ~CompressedBitVector() {}
+
+  using BitVector::n_bits;
+  using BitVector::COMPRESSED;
+  using BitVector::INTERLEAVED;
+  using BitVector::SELECT0;
+  using BitVector::SELECT1;
+  using BitVector::add;
+  using BitVector::resize;
+  using BitVector::set;
+  using BitVector::set_shared;
+
+  // append() appends the first n bits of rhs, which is not built yet.
+  void append(const CompressedBitVector &rhs, uint64_t n) {
+    assert(rhs.encoding == PLAIN);
+    BitVector::append(rhs, n);
+  }
+
+  // Only the plain indexes are built on n_threads threads.
+  void build(uint64_t flags = SELECT0 | SELECT1, uint64_t n_threads = 1) {
+    encoding = PLAIN;
+    if (!(flags & COMPRESSED)) {
+      BitVector::build(flags, n_threads);
+      return;
+    }
+    elias_fano.build(*this, (flags & INTERLEAVED) | SELECT0 | SELECT1);
+    rrr.build(*this);
+    BitVector::build(flags, n_threads);
+    uint64_t plain_size = BitVector::size();
+    if (elias_fano.size() < min(plain_size, rrr.size())) {
+      encoding = ELIAS_FANO;
+    } else if (rrr.size() < plain_size) {
+      encoding = RRR;
+    }
+    if (encoding != ELIAS_FANO) {
+      elias_fano = EliasFano();
+    }
+    if (encoding != RRR) {
+      rrr = RrrVector();
+    }
+    if (encoding != PLAIN) {
+      words = Vector<uint64_t>();
+      ranks = Vector<Rank>();
+      select0s = Vector<uint64_t>();
+      select1s = Vector<uint64_t>();
+      lines = Vector<Line>();
+    }
+  }
+
+  uint64_t size() const {
+    switch (encoding) {
+      case ELIAS_FANO:
+        return elias_fano.size();
+      case RRR:
+        return rrr.size();
+      default:
+        return BitVector::size();
+    }
+  }
+
+  void write(Writer &writer) const {
+    BitVector::write(writer);
+    writer.write(encoding);
+    elias_fano.write(writer);
+    rrr.write(writer);
+  }
+  void map(Mapper &mapper) {
+    BitVector::map(mapper);
+    mapper.map(encoding);
+    elias_fano.map(mapper);
+    rrr.map(mapper);
+  }
+
+  uint64_t operator[](uint64_t i) const {
+    if (encoding == PLAIN) {
+      return BitVector::operator[](i);
+    }
+    return (encoding == ELIAS_FANO) ? elias_fano[i] : rrr[i];
+  }
+
+  void prefetch(uint64_t i) const {
+    if (encoding == PLAIN) {
+      BitVector::prefetch(i);
+    } else {
+      prefetch_rank(i);
+    }
+  }
+  void prefetch_rank(uint64_t i) const {
+    if (encoding == PLAIN) {
+      BitVector::prefetch_rank(i);
+    } else if (encoding == ELIAS_FANO) {
+      elias_fano.prefetch_rank(i);
+    } else {
+      rrr.prefetch_rank(i);
+    }
+  }
+  void prefetch_select1_sample(uint64_t i) const {
+    if (encoding == PLAIN) {
+      BitVector::prefetch_select1_sample(i);
+    } else if (encoding == ELIAS_FANO) {
+      elias_fano.prefetch_select1_sample(i);
+    }
+  }
+  void prefetch_select1_block(uint64_t i) const {
+    if (encoding == PLAIN) {
+      BitVector::prefetch_select1_block(i);
+    } else if (encoding == ELIAS_FANO) {
+      elias_fano.prefetch_select1_block(i);
+    }
+  }
+
+  uint64_t rank1(uint64_t i) const {
+    if (encoding == PLAIN) {
+      return BitVector::rank1(i);
+    }
+    return (encoding == ELIAS_FANO) ? elias_fano.rank1(i) : rrr.rank1(i);
+  }
+  uint64_t select1(uint64_t i) const {
+    if (encoding == PLAIN) {
+      return BitVector::select1(i);
+    }
+    return (encoding == ELIAS_FANO) ? elias_fano.select1(i) : rrr.select1(i);
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // COMPRESSED_BIT_VECTOR_HPP
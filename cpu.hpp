@@ -0,0 +1,62 @@
+#ifndef CPU_HPP
+#define CPU_HPP
+
+#include <cpuid.h>
+
+#include <cstring>
+
+namespace trie_eval {
+
+using namespace std;
+
+// Cpu describes the features of the running processor. The binary is built
+// for a baseline target and functions which need more use target attributes
+// and are dispatched on CPU.
+struct Cpu {
+  bool popcnt;
+  bool bmi2;
+  bool avx2;
+  // VPOPCNTQ on 256-bit vectors needs both AVX512_VPOPCNTDQ and AVX512VL.
+  bool avx512_vpopcntdq;
+  // PDEP and PEXT are microcoded on AMD processors before Zen 3 and on
+  // Hygon processors, which are based on Zen 1.
+  bool fast_bmi2;
+};
+
+inline Cpu detect_cpu() {
+  Cpu cpu = {};
+  __builtin_cpu_init();
+  cpu.popcnt = __builtin_cpu_supports("popcnt");
+  cpu.bmi2 = __builtin_cpu_supports("bmi2");
+  cpu.avx2 = __builtin_cpu_supports("avx2");
+  cpu.avx512_vpopcntdq = __builtin_cpu_supports("avx512vpopcntdq") &&
+    __builtin_cpu_supports("avx512vl");
+  cpu.fast_bmi2 = cpu.bmi2;
+  // The vendor is in EBX, EDX and ECX of leaf 0.
+  unsigned int eax, ebx, ecx, edx;
+  char vendor[13] = {};
+  if (__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+  }
+  if (strcmp(vendor, "AuthenticAMD") == 0 ||
+    strcmp(vendor, "HygonGenuine") == 0) {
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      unsigned int family = (eax >> 8) & 0xF;
+      if (family == 0xF) {
+        family += (eax >> 20) & 0xFF;
+      }
+      if (family < 0x19) {
+        cpu.fast_bmi2 = false;
+      }
+    }
+  }
+  return cpu;
+}
+
+inline const Cpu CPU = detect_cpu();
+
+}  // namespace trie_eval
+
+#endif  // CPU_HPP
@@ -0,0 +1,170 @@
+#ifndef DAC_VECTOR_HPP
+#define DAC_VECTOR_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "bit-vector.hpp"
+#include "int-vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// DacVector is an integer vector of directly addressable codes (Brisaboa,
+// Ladra and Navarro, "DACs: Bringing direct access to variable-length
+// codes", 2013). A value is split into chunks of levels[0].width bits,
+// levels[1].width bits and so on from the lowest. Level l keeps the l-th
+// chunks of the values which have one, and its more bits tell whether a
+// value goes on. The next chunk of the value at i in level l is then at
+// more.rank1(i) in level l + 1, so small values take few bits and any
+// value is read in O(number of its chunks).
+struct DacVector {
+  struct Level {
+    IntVector chunks;
+    BitVector more;
+    uint64_t width;
+
+    Level() : chunks(), more(), width(0) {}
+
+    uint64_t size() const {
+      return chunks.size() + more.size();
+    }
+
+    void write(Writer &writer) const {
+      chunks.write(writer);
+      more.write(writer);
+      writer.write(width);
+    }
+    void map(Mapper &mapper) {
+      chunks.map(mapper);
+      more.map(mapper);
+      mapper.map(width);
+    }
+  };
+
+  vector<Level> levels;
+  uint64_t n_ints;
+
+  DacVector() : levels(), n_ints(0) {}
+  ~DacVector() {}
+
+  // build() chooses the widths of the levels which minimize the size for
+  // values and encodes them. flags are for the more bits, which only need
+  // rank1().
+  void build(const vector<uint64_t> &values, uint64_t flags = 0) {
+    levels.clear();
+    n_ints = values.size();
+    if (values.empty()) {
+      return;
+    }
+    // n_longer[b] is the number of values longer than b bits, which have
+    // a chunk in a level starting at bit b.
+    vector<uint64_t> n_longer(65, 0);
+    for (uint64_t value : values) {
+      uint64_t length = (value != 0) ? (64 - __builtin_clzll(value)) : 1;
+      ++n_longer[length - 1];
+    }
+    uint64_t max_length = 64;
+    while (n_longer[max_length - 1] == 0) {
+      --max_length;
+    }
+    for (uint64_t b = max_length - 1; b > 0; --b) {
+      n_longer[b - 1] += n_longer[b];
+    }
+    // costs[b] is the size in 1/32 bits of the levels from bit b, where a
+    // chunk costs the width it is stored in (see IntVector::stored_bits())
+    // and a more bit costs 1 bit and 1/256 of a BitVector::Rank, 40/32 bits,
+    // and widths[b] is the width of the level starting at bit b.
+    const uint64_t more_cost = 32 + ((sizeof(BitVector::Rank) * 8 * 32) / 256);
+    vector<uint64_t> costs(max_length + 1, 0);
+    vector<uint64_t> widths(max_length + 1, 0);
+    for (uint64_t b = max_length; b-- > 0; ) {
+      costs[b] = UINT64_MAX;
+      for (uint64_t width = 1; b + width <= max_length; ++width) {
+        uint64_t cost = (n_longer[b] * IntVector::stored_bits(width) * 32) +
+          costs[b + width];
+        if (b + width < max_length) {
+          cost += n_longer[b] * more_cost;
+        }
+        if (cost < costs[b]) {
+          costs[b] = cost;
+          widths[b] = width;
+        }
+      }
+    }
+    vector<uint64_t> ids(values.size());
+    for (uint64_t i = 0; i < ids.size(); ++i) {
+      ids[i] = i;
+    }
+    for (uint64_t b = 0; b < max_length; b += widths[b]) {
+      Level &level = levels.emplace_back();
+      level.width = widths[b];
+      level.chunks.init(ids.size(), (1UL << level.width) - 1);
+      bool last = (b + level.width == max_length);
+      vector<uint64_t> next_ids;
+      for (uint64_t i = 0; i < ids.size(); ++i) {
+        uint64_t value = values[ids[i]] >> b;
+        level.chunks.set(i, value);
+        if (!last) {
+          level.more.add((value >> level.width) != 0);
+          if ((value >> level.width) != 0) {
+            next_ids.push_back(ids[i]);
+          }
+        }
+      }
+      if (!last) {
+        level.more.build(flags);
+      }
+      ids.swap(next_ids);
+    }
+  }
+
+  uint64_t size() const {
+    uint64_t size = 0;
+    for (const Level &level : levels) {
+      size += level.size();
+    }
+    return size;
+  }
+
+  void write(Writer &writer) const {
+    writer.write((uint64_t)levels.size());
+    for (const Level &level : levels) {
+      level.write(writer);
+    }
+    writer.write(n_ints);
+  }
+  void map(Mapper &mapper) {
+    uint64_t n_levels = 0;
+    mapper.map(n_levels);
+    if (!mapper.check(n_levels <= 64)) {
+      return;
+    }
+    levels.resize(n_levels);
+    for (Level &level : levels) {
+      level.map(mapper);
+    }
+    mapper.map(n_ints);
+  }
+
+  uint64_t operator[](uint64_t i) const {
+    assert(i < n_ints);
+    uint64_t value = levels[0].chunks[i];
+    uint64_t shift = levels[0].width;
+    for (uint64_t l = 0; (l + 1 < levels.size()) && levels[l].more[i]; ++l) {
+      i = levels[l].more.rank1(i);
+      value |= levels[l + 1].chunks[i] << shift;
+      shift += levels[l + 1].width;
+    }
+    return value;
+  }
+  void prefetch(uint64_t i) const {
+    levels[0].chunks.prefetch(i);
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // DAC_VECTOR_HPP
@@ -0,0 +1,581 @@
+#include "double-array.hpp"
+
+#include <algorithm>
+
+#include "batch.hpp"
+#include "parallel.hpp"
+
+namespace trie_eval {
+namespace {
+
+// The root is unit 0 and its children are at 1 + code, before the
+// subtrees.
+const uint64_t ROOT_BASE = 1;
+const uint64_t N_ROOT_UNITS = ROOT_BASE + 257;
+
+struct LookupState {
+  string_view query;
+  uint64_t *id;
+  uint64_t i;
+  uint64_t node_id;
+  uint64_t child_id;
+  // child_id is a leaf whose tail is to be matched.
+  bool leaf;
+  bool done;
+};
+
+struct ReverseLookupState {
+  string *key;
+  uint64_t node_id;
+  uint64_t parent_id;
+  bool done;
+};
+
+// code() returns the code of the i-th byte of query, or 0 at its end.
+uint64_t code(string_view query, uint64_t i) {
+  return (i < query.length()) ? ((uint8_t)query[i] + 1) : 0;
+}
+
+}  // namespace
+
+// SubtreeBuilder places the subtree of a child of the root in units of its
+// own, as darts-clone does. Free units are linked in order of position and
+// the first which leaves room for the codes of a node becomes its base.
+// Units more than CLOSE_DISTANCE behind the end are no longer linked, which
+// bounds the time of a search for room.
+class DoubleArray::SubtreeBuilder {
+ public:
+  // ROOT is the check of the children of the subtree root, which is out of
+  // the units.
+  static constexpr uint32_t ROOT = UINT32_MAX - 1;
+  static constexpr uint64_t CLOSE_DISTANCE = 256 * 16;
+
+  vector<Unit> units;
+
+  SubtreeBuilder(const vector<string> &keys, vector<uint32_t> &tail_lengths,
+    vector<uint8_t> &tail_bytes)
+    : units(), keys_(keys), tail_lengths_(tail_lengths),
+      tail_bytes_(tail_bytes), next_(), prev_(), head_(NONE), last_(NONE) {}
+
+  // build() places the children of the node of keys[begin, end) at depth,
+  // whose unit is parent, and returns their base.
+  uint32_t build(uint64_t begin, uint64_t end, uint64_t depth,
+    uint32_t parent) {
+    // The key which ends at depth comes first and its code is 0.
+    vector<uint64_t> codes;
+    vector<uint64_t> bounds;
+    for (uint64_t i = begin; i < end; ++i) {
+      uint64_t code = trie_eval::code(keys_[i], depth);
+      if (codes.empty() || code != codes.back()) {
+        codes.push_back(code);
+        bounds.push_back(i);
+      }
+    }
+    bounds.push_back(end);
+
+    uint32_t base = place(codes, parent);
+    for (uint64_t j = 0; j < codes.size(); ++j) {
+      uint32_t child_id = base + codes[j];
+      if (codes[j] == 0 || bounds[j + 1] - bounds[j] == 1) {
+        add_leaf(child_id, bounds[j], depth + (codes[j] != 0));
+      } else {
+        uint32_t child_base = build(bounds[j], bounds[j + 1], depth + 1,
+          child_id);
+        units[child_id].base = child_base;
+      }
+    }
+    return base;
+  }
+
+  // finish() drops the free units at the end.
+  void finish() {
+    while (!units.empty() && units.back().check == Unit::FREE) {
+      units.pop_back();
+    }
+  }
+
+ private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  const vector<string> &keys_;
+  vector<uint32_t> &tail_lengths_;
+  vector<uint8_t> &tail_bytes_;
+  vector<uint32_t> next_;
+  vector<uint32_t> prev_;
+  uint32_t head_;
+  uint32_t last_;
+
+  void add_leaf(uint32_t unit_id, uint64_t key_id, uint64_t depth) {
+    units[unit_id].base = Unit::LEAF | key_id;
+    const string &key = keys_[key_id];
+    tail_lengths_[key_id] = key.length() - depth;
+    tail_bytes_.insert(tail_bytes_.end(), key.begin() + depth, key.end());
+  }
+
+  // place() finds a base for codes, which are sorted, and claims the units.
+  uint32_t place(const vector<uint64_t> &codes, uint32_t parent) {
+    uint64_t base = units.size();
+    for (uint32_t unit_id = head_; unit_id != NONE;
+      unit_id = next_[unit_id]) {
+      if (unit_id >= codes[0] && fits(unit_id - codes[0], codes)) {
+        base = unit_id - codes[0];
+        break;
+      }
+    }
+    while (units.size() <= base + codes.back()) {
+      extend();
+    }
+    for (uint64_t code : codes) {
+      uint32_t unit_id = base + code;
+      unlink(unit_id);
+      units[unit_id].check = parent;
+    }
+    return base;
+  }
+  bool fits(uint64_t base, const vector<uint64_t> &codes) const {
+    for (uint64_t code : codes) {
+      uint64_t unit_id = base + code;
+      if (unit_id < units.size() && units[unit_id].check != Unit::FREE) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // extend() adds 256 free units and unlinks those which are too far
+  // behind.
+  void extend() {
+    uint64_t begin = units.size();
+    assert(begin + 256 < ROOT);
+    units.resize(begin + 256, Unit{ 0, Unit::FREE });
+    next_.resize(begin + 256, NONE);
+    prev_.resize(begin + 256, NONE);
+    for (uint64_t unit_id = begin; unit_id < units.size(); ++unit_id) {
+      prev_[unit_id] = last_;
+      if (last_ != NONE) {
+        next_[last_] = unit_id;
+      } else {
+        head_ = unit_id;
+      }
+      last_ = unit_id;
+    }
+    while (head_ != NONE && head_ + CLOSE_DISTANCE < begin) {
+      unlink(head_);
+    }
+  }
+  void unlink(uint32_t unit_id) {
+    if (prev_[unit_id] == NONE && head_ != unit_id) {
+      return;
+    }
+    if (prev_[unit_id] != NONE) {
+      next_[prev_[unit_id]] = next_[unit_id];
+    } else {
+      head_ = next_[unit_id];
+    }
+    if (next_[unit_id] != NONE) {
+      prev_[next_[unit_id]] = prev_[unit_id];
+    } else {
+      last_ = prev_[unit_id];
+    }
+    next_[unit_id] = NONE;
+    prev_[unit_id] = NONE;
+  }
+};
+
+DoubleArray::DoubleArray(uint64_t flags)
+  : units_(), leaves_(), tail_offsets_(), tail_bytes_(), n_keys_(0),
+    size_(0), flags_(flags), mapper_() {}
+
+void DoubleArray::build(const vector<string> &keys) {
+  build(keys, 1);
+}
+
+// build() places the subtree of each child of the root apart, and then
+// moves the subtrees after the children of the root in order of their
+// codes. A child of the root with one key is a leaf and has no subtree.
+void DoubleArray::build(const vector<string> &keys, uint64_t n_threads) {
+  assert(keys.size() < Unit::LEAF);
+  // A group has the keys with the same first byte, or the empty key.
+  vector<uint64_t> bounds(1, 0);
+  for (uint64_t i = 1; i < keys.size(); ++i) {
+    if (code(keys[i], 0) != code(keys[i - 1], 0)) {
+      bounds.push_back(i);
+    }
+  }
+  if (!keys.empty()) {
+    bounds.push_back(keys.size());
+  }
+  struct Group {
+    vector<Unit> units;
+    vector<uint8_t> tail_bytes;
+    uint32_t base;
+  };
+  vector<Group> groups(bounds.size() - 1);
+  vector<uint32_t> tail_lengths(keys.size());
+  parallel(n_threads, groups.size(), [&](uint64_t group_id) {
+    Group &group = groups[group_id];
+    uint64_t begin = bounds[group_id];
+    uint64_t end = bounds[group_id + 1];
+    if (end - begin == 1) {
+      uint64_t depth = keys[begin].empty() ? 0 : 1;
+      group.base = Unit::LEAF | begin;
+      tail_lengths[begin] = keys[begin].length() - depth;
+      group.tail_bytes.assign(keys[begin].begin() + depth,
+        keys[begin].end());
+      return;
+    }
+    SubtreeBuilder builder(keys, tail_lengths, group.tail_bytes);
+    group.base = builder.build(begin, end, 1, SubtreeBuilder::ROOT);
+    builder.finish();
+    group.units = move(builder.units);
+  });
+
+  // Units of a subtree move by offset and the children of its root get the
+  // root as their check. 257 free units at the end keep base + code in
+  // range.
+  units_.clear();
+  units_.resize(N_ROOT_UNITS, Unit{ 0, Unit::FREE });
+  units_[0].base = ROOT_BASE;
+  for (uint64_t group_id = 0; group_id < groups.size(); ++group_id) {
+    Group &group = groups[group_id];
+    uint64_t node_id = ROOT_BASE + code(keys[bounds[group_id]], 0);
+    units_[node_id].check = 0;
+    if (group.base & Unit::LEAF) {
+      units_[node_id].base = group.base;
+      continue;
+    }
+    uint64_t offset = units_.size();
+    assert(offset + group.units.size() + 257 < Unit::LEAF);
+    units_[node_id].base = group.base + offset;
+    for (const Unit &unit : group.units) {
+      Unit moved = unit;
+      if (unit.check != Unit::FREE) {
+        moved.check = (unit.check == SubtreeBuilder::ROOT) ?
+          node_id : (unit.check + offset);
+        if (!unit.leaf()) {
+          moved.base += offset;
+        }
+      }
+      units_.push_back(moved);
+    }
+    vector<Unit>().swap(group.units);
+  }
+  units_.resize(units_.size() + 257, Unit{ 0, Unit::FREE });
+
+  leaves_.clear();
+  leaves_.resize(keys.size());
+  for (uint64_t unit_id = 0; unit_id < units_.size(); ++unit_id) {
+    const Unit &unit = units_[unit_id];
+    if (unit.check != Unit::FREE && unit.leaf()) {
+      leaves_[unit.key_id()] = unit_id;
+    }
+  }
+  tail_offsets_.clear();
+  tail_offsets_.resize(keys.size() + 1);
+  // Tail offsets are 32-bit, as are leaves.
+  uint64_t tail_offset = 0;
+  tail_offsets_[0] = 0;
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    tail_offset += tail_lengths[i];
+    assert(tail_offset <= UINT32_MAX);
+    tail_offsets_[i + 1] = tail_offset;
+  }
+  tail_bytes_.clear();
+  tail_bytes_.reserve(tail_offsets_[keys.size()]);
+  for (const Group &group : groups) {
+    for (uint8_t byte : group.tail_bytes) {
+      tail_bytes_.push_back(byte);
+    }
+  }
+
+  n_keys_ = keys.size();
+  size_ = sizeof(Unit) * units_.size();
+  size_ += sizeof(uint32_t) * leaves_.size();
+  size_ += sizeof(uint32_t) * tail_offsets_.size();
+  size_ += tail_bytes_.size();
+}
+
+uint64_t DoubleArray::lookup(const string &query) const {
+  uint64_t node_id = 0;
+  for (uint64_t i = 0; ; ++i) {
+    uint64_t code = trie_eval::code(query, i);
+    node_id = child(node_id, code);
+    if (node_id == (uint64_t)-1) {
+      return -1;
+    }
+    const Unit &unit = units_[node_id];
+    if (unit.leaf()) {
+      string_view rest = string_view(query).substr(min(i + 1,
+        (uint64_t)query.length()));
+      return match_tail(unit.key_id(), rest) ? unit.key_id() : -1;
+    }
+    // The end of a key is always a leaf.
+    assert(code != 0);
+  }
+}
+
+void DoubleArray::reverse_lookup(uint64_t id, string &key) const {
+  assert(id < n_keys());
+  key.clear();
+  string_view tail = this->tail(id);
+  key.append(tail.rbegin(), tail.rend());
+  uint64_t node_id = leaves_[id];
+  while (node_id != 0) {
+    uint64_t parent_id = units_[node_id].check;
+    uint64_t code = node_id - units_[parent_id].base;
+    if (code != 0) {
+      key.push_back(code - 1);
+    }
+    node_id = parent_id;
+  }
+  reverse(key.begin(), key.end());
+}
+
+void DoubleArray::lookup_batch(span<const string_view> queries,
+  span<uint64_t> ids) const {
+  assert(queries.size() == ids.size());
+  interleave<LookupState>(queries.size(),
+    [&](LookupState &state, uint64_t i) {
+      state.query = queries[i];
+      state.id = &ids[i];
+      state.i = 0;
+      state.node_id = 0;
+      state.child_id = units_[0].base + code(state.query, 0);
+      state.leaf = false;
+      __builtin_prefetch(&units_[state.child_id]);
+      return true;
+    },
+    // A round moves each state on to a child of its node.
+    [&](LookupState *states, uint64_t n_states) {
+      uint64_t n_leaves = 0;
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        const Unit &unit = units_[state.child_id];
+        if (unit.check != state.node_id) {
+          *state.id = -1;
+          state.done = true;
+        } else if (unit.leaf()) {
+          state.leaf = true;
+          __builtin_prefetch(tail_offsets_.data() + unit.key_id());
+          ++n_leaves;
+        } else {
+          state.node_id = state.child_id;
+          state.child_id = unit.base + code(state.query, ++state.i);
+          __builtin_prefetch(&units_[state.child_id]);
+        }
+      }
+      if (n_leaves == 0) {
+        return;
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        const LookupState &state = states[j];
+        if (state.leaf) {
+          uint64_t key_id = units_[state.child_id].key_id();
+          __builtin_prefetch(tail_bytes_.data() + tail_offsets_[key_id]);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        if (state.leaf) {
+          uint64_t key_id = units_[state.child_id].key_id();
+          string_view rest = state.query.substr(min(state.i + 1,
+            (uint64_t)state.query.length()));
+          *state.id = match_tail(key_id, rest) ? key_id : -1;
+          state.done = true;
+        }
+      }
+    });
+}
+
+void DoubleArray::reverse_lookup_batch(span<const uint64_t> ids,
+  span<string> keys) const {
+  assert(ids.size() == keys.size());
+  interleave<ReverseLookupState>(ids.size(),
+    [&](ReverseLookupState &state, uint64_t i) {
+      assert(ids[i] < n_keys());
+      state.key = &keys[i];
+      state.key->clear();
+      string_view tail = this->tail(ids[i]);
+      state.key->append(tail.rbegin(), tail.rend());
+      state.node_id = leaves_[ids[i]];
+      state.parent_id = units_[state.node_id].check;
+      __builtin_prefetch(&units_[state.parent_id]);
+      return true;
+    },
+    // A round moves each state up to the parent of its node, whose base
+    // gives the code of the node and whose check is the next parent.
+    [&](ReverseLookupState *states, uint64_t n_states) {
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        const Unit &parent = units_[state.parent_id];
+        uint64_t code = state.node_id - parent.base;
+        if (code != 0) {
+          state.key->push_back(code - 1);
+        }
+        state.node_id = state.parent_id;
+        if (state.node_id == 0) {
+          reverse(state.key->begin(), state.key->end());
+          state.done = true;
+        } else {
+          state.parent_id = parent.check;
+          __builtin_prefetch(&units_[state.parent_id]);
+        }
+      }
+    });
+}
+
+bool DoubleArray::Cursor::next() {
+  if (leaf_id_ != (uint64_t)-1) {
+    id_ = leaf_id_;
+    leaf_id_ = -1;
+    return true;
+  }
+  while (!stack_.empty()) {
+    Frame &frame = stack_.back();
+    // The children are the units in [base, base + 256] which have the node
+    // as their check, and the scan over them reads no other unit.
+    const Unit *units =
+      trie_->units_.data() + trie_->units_[frame.node_id].base;
+    uint64_t code = frame.code;
+    while (code <= 256 && units[code].check != frame.node_id) {
+      ++code;
+    }
+    if (code > 256) {
+      stack_.pop_back();
+      continue;
+    }
+    frame.code = code + 1;
+    uint64_t child_id = units + code - trie_->units_.data();
+    key_.resize(frame.key_length);
+    if (code != 0) {
+      key_.push_back(code - 1);
+    }
+    const Unit &unit = trie_->units_[child_id];
+    if (unit.leaf()) {
+      key_.append(trie_->tail(unit.key_id()));
+      id_ = unit.key_id();
+      return true;
+    }
+    stack_.push_back(Frame{ child_id, key_.length(), 0 });
+  }
+  return false;
+}
+
+void DoubleArray::predictive_search(string_view prefix,
+  Cursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.stack_.clear();
+  cursor.key_.clear();
+  cursor.id_ = -1;
+  cursor.leaf_id_ = -1;
+  uint64_t node_id = 0;
+  for (uint64_t i = 0; i < prefix.length(); ++i) {
+    node_id = child(node_id, (uint8_t)prefix[i] + 1);
+    if (node_id == (uint64_t)-1) {
+      return;
+    }
+    const Unit &unit = units_[node_id];
+    if (unit.leaf()) {
+      // The prefix may end in the middle of the tail.
+      string_view tail = this->tail(unit.key_id());
+      if (tail.starts_with(prefix.substr(i + 1))) {
+        cursor.key_.assign(prefix.substr(0, i + 1));
+        cursor.key_.append(tail);
+        cursor.leaf_id_ = unit.key_id();
+      }
+      return;
+    }
+  }
+  cursor.key_.assign(prefix);
+  cursor.stack_.push_back(Cursor::Frame{ node_id, prefix.length(), 0 });
+}
+
+bool DoubleArray::PrefixCursor::next() {
+  while (node_id_ != (uint64_t)-1) {
+    uint64_t node_id = node_id_;
+    uint64_t pos = pos_;
+    // Move on to the child by the next byte of the query, if any.
+    node_id_ = -1;
+    if (pos < query_.length()) {
+      uint64_t child_id = trie_->child(node_id, (uint8_t)query_[pos] + 1);
+      if (child_id != (uint64_t)-1) {
+        const Unit &unit = trie_->units_[child_id];
+        if (!unit.leaf()) {
+          node_id_ = child_id;
+          pos_ = pos + 1;
+        } else {
+          string_view tail = trie_->tail(unit.key_id());
+          if (query_.substr(pos + 1).starts_with(tail)) {
+            leaf_id_ = unit.key_id();
+            leaf_length_ = pos + 1 + tail.length();
+          }
+        }
+      }
+    }
+    uint64_t end_id = trie_->child(node_id, 0);
+    if (end_id != (uint64_t)-1) {
+      length_ = pos;
+      id_ = trie_->units_[end_id].key_id();
+      return true;
+    }
+  }
+  if (leaf_id_ != (uint64_t)-1) {
+    length_ = leaf_length_;
+    id_ = leaf_id_;
+    leaf_id_ = -1;
+    return true;
+  }
+  return false;
+}
+
+void DoubleArray::common_prefix_search(string_view query,
+  PrefixCursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.query_ = query;
+  cursor.node_id_ = 0;
+  cursor.pos_ = 0;
+  cursor.length_ = 0;
+  cursor.id_ = -1;
+  cursor.leaf_id_ = -1;
+}
+
+bool DoubleArray::save(const char *path) const {
+  Writer writer;
+  if (!writer.open(path)) {
+    return false;
+  }
+  writer.write_header(name());
+  units_.write(writer);
+  leaves_.write(writer);
+  tail_offsets_.write(writer);
+  tail_bytes_.write(writer);
+  writer.write(n_keys_);
+  writer.write(size_);
+  writer.write(flags_);
+  return writer.close();
+}
+
+bool DoubleArray::map(const char *path) {
+  Mapper mapper;
+  if (!mapper.open(path) || !mapper.map_header(name())) {
+    return false;
+  }
+  // The file is mapped into a new trie, so that this one is kept if the
+  // file is broken.
+  DoubleArray trie;
+  trie.units_.map(mapper);
+  trie.leaves_.map(mapper);
+  trie.tail_offsets_.map(mapper);
+  trie.tail_bytes_.map(mapper);
+  mapper.map(trie.n_keys_);
+  mapper.map(trie.size_);
+  mapper.map(trie.flags_);
+  if (!mapper.ok()) {
+    return false;
+  }
+  trie.mapper_ = move(mapper);
+  *this = move(trie);
+  return true;
+}
+
+}  // namespace trie_eval
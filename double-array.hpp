@@ -0,0 +1,196 @@
+#ifndef DOUBLE_ARRAY_HPP
+#define DOUBLE_ARRAY_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "io.hpp"
+#include "trie-base.hpp"
+#include "vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// DoubleArray is a double-array trie, the pointer-free but not succinct
+// baseline for the other engines. The children of a node are at its base
+// plus their codes, where a byte is coded as byte + 1 and 0 is the end of a
+// key, and the check of a unit is its parent. A node with one key below it
+// is a leaf whose base is the key ID, and the rest of the key is its tail.
+// IDs are in lexicographic order of keys.
+class DoubleArray : TrieBase {
+ public:
+  explicit DoubleArray(uint64_t flags = 0);
+  ~DoubleArray() {}
+
+  DoubleArray(DoubleArray &&) = default;
+  DoubleArray &operator=(DoubleArray &&) = default;
+
+  void build(const vector<string> &keys);
+  // build() with n_threads builds the subtrees of the children of the root
+  // on up to n_threads threads. Each is placed apart and then moved after
+  // the others, so the trie is the same as with one.
+  void build(const vector<string> &keys, uint64_t n_threads);
+
+  uint64_t lookup(const string &query) const;
+  void reverse_lookup(uint64_t id, string &key) const;
+
+  void lookup_batch(span<const string_view> queries,
+    span<uint64_t> ids) const;
+  void reverse_lookup_batch(span<const uint64_t> ids,
+    span<string> keys) const;
+
+  // Cursor enumerates keys in lexicographic order. key() is a buffer which
+  // is reused by next(), so no string is allocated per key.
+  class Cursor {
+   public:
+    Cursor() : trie_(nullptr), stack_(), key_(), id_(-1), leaf_id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    const string &key() const {
+      return key_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class DoubleArray;
+
+    // A frame tries the codes of a node from code.
+    struct Frame {
+      uint64_t node_id;
+      uint64_t key_length;
+      uint64_t code;
+    };
+
+    const DoubleArray *trie_;
+    vector<Frame> stack_;
+    string key_;
+    uint64_t id_;
+    // leaf_id_ is a key found by predictive_search() in a tail.
+    uint64_t leaf_id_;
+  };
+
+  // predictive_search() sets cursor to the keys which start with prefix.
+  void predictive_search(string_view prefix, Cursor &cursor) const;
+
+  // PrefixCursor enumerates the keys which are prefixes of a query in order
+  // of length.
+  class PrefixCursor {
+   public:
+    PrefixCursor()
+      : trie_(nullptr), query_(), node_id_(-1), pos_(0), length_(0),
+        id_(-1), leaf_id_(-1), leaf_length_(0) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    // The key is the first length() bytes of the query.
+    uint64_t length() const {
+      return length_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class DoubleArray;
+
+    const DoubleArray *trie_;
+    string_view query_;
+    // node_id_ is the next node to visit and the first pos_ bytes of the
+    // query are its key.
+    uint64_t node_id_;
+    uint64_t pos_;
+    uint64_t length_;
+    uint64_t id_;
+    // leaf_id_ is a key which ends in a tail, after the others.
+    uint64_t leaf_id_;
+    uint64_t leaf_length_;
+  };
+
+  // common_prefix_search() sets cursor to the keys which are prefixes of
+  // query.
+  void common_prefix_search(string_view query, PrefixCursor &cursor) const;
+
+  bool save(const char *path) const;
+  bool map(const char *path);
+
+  const char *name() const {
+    return "Double array + tails";
+  }
+  uint64_t n_keys() const {
+    return n_keys_;
+  }
+  uint64_t n_units() const {
+    return units_.size();
+  }
+  uint64_t size() const {
+    return size_;
+  }
+  uint64_t flags() const {
+    return flags_;
+  }
+
+ private:
+  // Unit is a node. The base of a leaf is LEAF | key_id and a free unit
+  // has FREE as its check.
+  struct Unit {
+    uint32_t base;
+    uint32_t check;
+
+    static constexpr uint32_t LEAF = 1U << 31;
+    static constexpr uint32_t FREE = UINT32_MAX;
+
+    bool leaf() const {
+      return (base & LEAF) != 0;
+    }
+    uint64_t key_id() const {
+      return base & ~LEAF;
+    }
+  };
+
+  class SubtreeBuilder;
+
+  Vector<Unit> units_;
+  // leaves_[key_id] is the leaf of a key and tail_offsets_[key_id] is the
+  // position of its tail in tail_bytes_.
+  Vector<uint32_t> leaves_;
+  Vector<uint32_t> tail_offsets_;
+  Vector<uint8_t> tail_bytes_;
+  uint64_t n_keys_;
+  uint64_t size_;
+  uint64_t flags_;
+  Mapper mapper_;
+
+  // child() returns the child of node_id by code or -1 if there is none.
+  uint64_t child(uint64_t node_id, uint64_t code) const {
+    uint64_t child_id = units_[node_id].base + code;
+    return (units_[child_id].check == node_id) ? child_id : -1;
+  }
+  // match_tail() tells if the tail of key_id is rest.
+  bool match_tail(uint64_t key_id, string_view rest) const {
+    uint64_t begin = tail_offsets_[key_id];
+    uint64_t end = tail_offsets_[key_id + 1];
+    // tail_bytes_ is null if there are no tails, which memcmp() must not
+    // be given even for 0 bytes.
+    return (rest.length() == end - begin) && (rest.empty() ||
+      memcmp(tail_bytes_.data() + begin, rest.data(), rest.length()) == 0);
+  }
+  // tail() returns the tail of key_id.
+  string_view tail(uint64_t key_id) const {
+    uint64_t begin = tail_offsets_[key_id];
+    return string_view(reinterpret_cast<const char *>(tail_bytes_.data()) +
+      begin, tail_offsets_[key_id + 1] - begin);
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // DOUBLE_ARRAY_HPP
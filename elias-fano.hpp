@@ -0,0 +1,132 @@
+#ifndef ELIAS_FANO_HPP
+#define ELIAS_FANO_HPP
+
+#include <cassert>
+#include <cstdint>
+
+#include "bit-vector.hpp"
+#include "int-vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// EliasFano is a compressed bit vector for sparse bits. The position of the
+// k-th 1 is split into its low_bits lower bits, which are kept in lows, and
+// the rest, its high part, which is kept in unary in highs by setting the
+// (high + k)-th bit. select1() is then a select1() on highs. rank1() and
+// operator[] find the 1s with the same high part by a select0() on highs
+// and compare their lower bits.
+struct EliasFano {
+  BitVector highs;
+  IntVector lows;
+  uint64_t n_bits;
+  uint64_t n_ones;
+  uint64_t low_bits;
+
+  EliasFano() : highs(), lows(), n_bits(0), n_ones(0), low_bits(0) {}
+  ~EliasFano() {}
+
+  // build() encodes the bits of bv, which need not be built. flags are for
+  // highs, which needs both selects.
+  void build(const BitVector &bv, uint64_t flags = BitVector::SELECT0 |
+    BitVector::SELECT1) {
+    n_bits = bv.n_bits;
+    n_ones = 0;
+    for (uint64_t i = 0; i < (n_bits + 63) / 64; ++i) {
+      n_ones += __builtin_popcountll(bv.word(i));
+    }
+    low_bits = 0;
+    if (n_ones != 0 && (n_bits / n_ones) > 1) {
+      low_bits = 63 - __builtin_clzll(n_bits / n_ones);
+    }
+    lows.init((low_bits != 0) ? n_ones : 0, (1UL << low_bits) - 1);
+    highs.resize(n_ones + (n_bits >> low_bits) + 1);
+    uint64_t k = 0;
+    for (uint64_t i = 0; i < (n_bits + 63) / 64; ++i) {
+      for (uint64_t word = bv.word(i); word != 0; word &= word - 1) {
+        uint64_t pos = (i * 64) + __builtin_ctzll(word);
+        highs.set((pos >> low_bits) + k, 1);
+        if (low_bits != 0) {
+          lows.set(k, pos);
+        }
+        ++k;
+      }
+    }
+    highs.build(flags);
+  }
+
+  uint64_t size() const {
+    return highs.size() + lows.size();
+  }
+
+  void write(Writer &writer) const {
+    highs.write(writer);
+    lows.write(writer);
+    writer.write(n_bits);
+    writer.write(n_ones);
+    writer.write(low_bits);
+  }
+  void map(Mapper &mapper) {
+    highs.map(mapper);
+    lows.map(mapper);
+    mapper.map(n_bits);
+    mapper.map(n_ones);
+    mapper.map(low_bits);
+  }
+
+  uint64_t operator[](uint64_t i) const {
+    assert(i < n_bits);
+    uint64_t k;
+    uint64_t pos = find(i, k);
+    return highs[pos] && low(k) == (i & ((1UL << low_bits) - 1));
+  }
+
+  void prefetch_rank(uint64_t i) const {
+    highs.prefetch_select0_sample(i >> low_bits);
+  }
+  void prefetch_select1_sample(uint64_t i) const {
+    highs.prefetch_select1_sample(i);
+  }
+  void prefetch_select1_block(uint64_t i) const {
+    highs.prefetch_select1_block(i);
+  }
+
+  uint64_t rank1(uint64_t i) const {
+    assert(i <= n_bits);
+    if (n_ones == 0) {
+      return 0;
+    }
+    uint64_t k;
+    find(i, k);
+    return k;
+  }
+  uint64_t select1(uint64_t k) const {
+    assert(k < n_ones);
+    return ((highs.select1(k) - k) << low_bits) | low(k);
+  }
+
+ private:
+  uint64_t low(uint64_t k) const {
+    return (low_bits != 0) ? lows[k] : 0;
+  }
+
+  // find() returns the position in highs of the first 1 at or after i, or
+  // of the 0 after the 1s with the same high part, and sets k to the number
+  // of 1s before it.
+  uint64_t find(uint64_t i, uint64_t &k) const {
+    uint64_t high = i >> low_bits;
+    uint64_t low_i = i & ((1UL << low_bits) - 1);
+    uint64_t pos = (high != 0) ? (highs.select0(high - 1) + 1) : 0;
+    k = pos - high;
+    while (highs[pos] && low(k) < low_i) {
+      ++pos;
+      ++k;
+    }
+    return pos;
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // ELIAS_FANO_HPP
@@ -0,0 +1,73 @@
+#ifndef FIND_LABEL_HPP
+#define FIND_LABEL_HPP
+
+#include <x86intrin.h>
+
+#include <cstdint>
+
+#include "cpu.hpp"
+#include "vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// find_label_avx2() compares 32 labels at a time from begin while the loads
+// stay in [0, size). It returns the position of byte or -1 and moves begin
+// to the first label not compared.
+__attribute__((target("avx2")))
+inline uint64_t find_label_avx2(const uint8_t *labels, uint64_t &begin,
+  uint64_t end, uint64_t size, uint8_t byte) {
+  const __m256i bytes = _mm256_set1_epi8(byte);
+  for ( ; (begin < end) && (begin + 32 <= size); begin += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(labels + begin));
+    uint64_t mask = (uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(chunk, bytes));
+    if (end - begin < 32) {
+      mask &= (1UL << (end - begin)) - 1;
+    }
+    if (mask != 0) {
+      return begin + __builtin_ctzll(mask);
+    }
+  }
+  return -1;
+}
+
+// find_label() returns the position of byte in labels[begin, end) or end if
+// there is none. The labels of siblings are compared 16 (SSE2) or 32 (AVX2)
+// at a time instead of by binary search, whose branches mispredict in nodes
+// with many children. Labels near the end of labels, which may be mapped,
+// are compared one by one.
+inline uint64_t find_label(const Vector<uint8_t> &labels, uint64_t begin,
+  uint64_t end, uint8_t byte) {
+  const uint8_t *ptr = labels.data();
+  const uint64_t size = labels.size();
+  uint64_t i = begin;
+  if ((end - begin > 16) && CPU.avx2) {
+    uint64_t pos = find_label_avx2(ptr, i, end, size, byte);
+    if (pos != (uint64_t)-1) {
+      return pos;
+    }
+  }
+  const __m128i bytes = _mm_set1_epi8(byte);
+  for ( ; (i < end) && (i + 16 <= size); i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(ptr + i));
+    uint64_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, bytes));
+    if (end - i < 16) {
+      mask &= (1UL << (end - i)) - 1;
+    }
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  for ( ; i < end; ++i) {
+    if (ptr[i] == byte) {
+      return i;
+    }
+  }
+  return end;
+}
+
+}  // namespace trie_eval
+
+#endif  // FIND_LABEL_HPP
@@ -0,0 +1,494 @@
+#include "front-coding.hpp"
+
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "batch.hpp"
+#include "parallel.hpp"
+
+namespace trie_eval {
+namespace {
+
+// The buckets are encoded in chunks of this many buckets.
+const uint64_t CHUNK_SIZE = 1024;
+
+struct LookupState {
+  string_view query;
+  uint64_t *id;
+  uint64_t sample;
+  // A search step narrows [begin, end) down to the number of headers not
+  // greater than the query, and then the bucket is decoded.
+  uint64_t begin;
+  uint64_t end;
+  uint64_t pos;
+  enum Stage : uint8_t {
+    SEARCH,
+    OFFSET,
+    SCAN,
+  } stage;
+  bool done;
+};
+
+void encode_vbyte(string &bytes, uint64_t value) {
+  while (value >= 0x80) {
+    bytes.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  bytes.push_back((char)value);
+}
+
+uint64_t decode_vbyte(const uint8_t *&ptr) {
+  uint64_t value = 0;
+  for (uint64_t shift = 0; ; shift += 7) {
+    uint8_t byte = *ptr++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (byte < 0x80) {
+      return value;
+    }
+  }
+}
+
+// sample() returns the first 8 bytes of key as a big-endian integer,
+// padded with 0s, so that samples are in the order of keys.
+uint64_t sample(string_view key) {
+  uint64_t word = 0;
+  memcpy(&word, key.data(), min(key.length(), (size_t)8));
+  return __builtin_bswap64(word);
+}
+
+// common_prefix() returns the length of the common prefix of the first n
+// bytes of lhs and rhs. 16 bytes are compared at a time with SSE2 while
+// both have them, so nothing past n is read.
+uint64_t common_prefix(const void *lhs, const void *rhs, uint64_t n) {
+  const uint8_t *lhs_bytes = static_cast<const uint8_t *>(lhs);
+  const uint8_t *rhs_bytes = static_cast<const uint8_t *>(rhs);
+  uint64_t i = 0;
+  for ( ; i + 16 <= n; i += 16) {
+    __m128i lhs_chunk = _mm_loadu_si128((const __m128i *)(lhs_bytes + i));
+    __m128i rhs_chunk = _mm_loadu_si128((const __m128i *)(rhs_bytes + i));
+    uint64_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(lhs_chunk, rhs_chunk));
+    if (mask != 0xFFFF) {
+      return i + __builtin_ctzll(~mask);
+    }
+  }
+  while (i < n && lhs_bytes[i] == rhs_bytes[i]) {
+    ++i;
+  }
+  return i;
+}
+
+// compare() compares lhs_length bytes at lhs with rhs.
+int compare(const uint8_t *lhs, uint64_t lhs_length, string_view rhs) {
+  uint64_t n = min(lhs_length, (uint64_t)rhs.length());
+  uint64_t i = common_prefix(lhs, rhs.data(), n);
+  if (i != n) {
+    return (lhs[i] < (uint8_t)rhs[i]) ? -1 : 1;
+  }
+  return (lhs_length < rhs.length()) ? -1 : (lhs_length > rhs.length());
+}
+
+}  // namespace
+
+FrontCoding::FrontCoding(uint64_t flags)
+  : bytes_(), offsets_(), samples_(), n_keys_(0), bucket_size_(16),
+    size_(0), flags_(flags), mapper_() {
+  if (flags_ & TRIE_BUCKET_SIZE) {
+    bucket_size_ = 1UL << ((flags_ & TRIE_BUCKET_SIZE) >> 6);
+  }
+}
+
+void FrontCoding::build(const vector<string> &keys) {
+  build(keys, 1);
+}
+
+void FrontCoding::build(const vector<string> &keys, uint64_t n_threads) {
+  uint64_t n_buckets = (keys.size() + bucket_size_ - 1) / bucket_size_;
+  uint64_t n_chunks = (n_buckets + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  vector<string> chunks(n_chunks);
+  // ends[bucket] is the end of bucket in its chunk.
+  vector<uint64_t> ends(n_buckets);
+  parallel(n_threads, n_chunks, [&](uint64_t chunk_id) {
+    string &bytes = chunks[chunk_id];
+    uint64_t end = min((chunk_id + 1) * CHUNK_SIZE, n_buckets);
+    for (uint64_t bucket = chunk_id * CHUNK_SIZE; bucket < end; ++bucket) {
+      uint64_t begin = bucket * bucket_size_;
+      const string &header = keys[begin];
+      encode_vbyte(bytes, header.length());
+      bytes += header;
+      uint64_t key_end = min(begin + bucket_size_, (uint64_t)keys.size());
+      for (uint64_t i = begin + 1; i < key_end; ++i) {
+        const string &prev = keys[i - 1];
+        const string &key = keys[i];
+        uint64_t lcp = common_prefix(prev.data(), key.data(),
+          min(prev.length(), key.length()));
+        encode_vbyte(bytes, lcp);
+        encode_vbyte(bytes, key.length() - lcp);
+        bytes.append(key, lcp);
+      }
+      ends[bucket] = bytes.size();
+    }
+  });
+
+  uint64_t n_bytes = 0;
+  for (const string &bytes : chunks) {
+    n_bytes += bytes.size();
+  }
+  bytes_.clear();
+  bytes_.resize(n_bytes);
+  offsets_.init(n_buckets, n_bytes);
+  samples_.clear();
+  samples_.resize(n_buckets);
+  uint64_t offset = 0;
+  for (uint64_t chunk_id = 0; chunk_id < n_chunks; ++chunk_id) {
+    const string &bytes = chunks[chunk_id];
+    for (uint64_t i = 0; i < bytes.size(); ++i) {
+      bytes_[offset + i] = bytes[i];
+    }
+    uint64_t end = min((chunk_id + 1) * CHUNK_SIZE, n_buckets);
+    for (uint64_t bucket = chunk_id * CHUNK_SIZE; bucket < end; ++bucket) {
+      uint64_t begin = (bucket % CHUNK_SIZE == 0) ? 0 : ends[bucket - 1];
+      offsets_.set(bucket, offset + begin);
+      samples_[bucket] = sample(keys[bucket * bucket_size_]);
+    }
+    offset += bytes.size();
+  }
+
+  n_keys_ = keys.size();
+  size_ = bytes_.size();
+  size_ += offsets_.size();
+  size_ += sizeof(uint64_t) * samples_.size();
+}
+
+uint64_t FrontCoding::lookup(const string &query) const {
+  uint64_t bucket = find_bucket(query, 0, n_buckets());
+  if (bucket == (uint64_t)-1) {
+    return -1;
+  }
+  uint64_t match;
+  return find_in_bucket(bucket, query, match);
+}
+
+void FrontCoding::reverse_lookup(uint64_t id, string &key) const {
+  assert(id < n_keys());
+  const uint8_t *ptr = bytes_.data() + offsets_[id / bucket_size_];
+  uint64_t length = decode_vbyte(ptr);
+  key.assign(reinterpret_cast<const char *>(ptr), length);
+  ptr += length;
+  for (uint64_t i = id % bucket_size_; i != 0; --i) {
+    uint64_t lcp = decode_vbyte(ptr);
+    length = decode_vbyte(ptr);
+    key.resize(lcp);
+    key.append(reinterpret_cast<const char *>(ptr), length);
+    ptr += length;
+  }
+}
+
+void FrontCoding::lookup_batch(span<const string_view> queries,
+  span<uint64_t> ids) const {
+  assert(queries.size() == ids.size());
+  interleave<LookupState>(queries.size(),
+    [&](LookupState &state, uint64_t i) {
+      state.query = queries[i];
+      state.id = &ids[i];
+      state.sample = sample(state.query);
+      state.begin = 0;
+      state.end = n_buckets();
+      state.stage = LookupState::SEARCH;
+      __builtin_prefetch(samples_.data() + (state.begin + state.end) / 2);
+      return true;
+    },
+    // A round takes each state one step: a step of the search, whose
+    // sample is prefetched by the step before, the offset of the bucket or
+    // the scan of the bucket. The stages run from the last, so that a state
+    // takes one of them per round and what it prefetches has a round to
+    // arrive.
+    [&](LookupState *states, uint64_t n_states) {
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        if (state.stage == LookupState::SCAN) {
+          uint64_t match;
+          *state.id = find_in_bucket(state.end - 1, state.query, match);
+          state.done = true;
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        if (state.stage == LookupState::OFFSET) {
+          state.pos = offsets_[state.end - 1];
+          __builtin_prefetch(bytes_.data() + state.pos);
+          state.stage = LookupState::SCAN;
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        if (state.stage != LookupState::SEARCH) {
+          continue;
+        }
+        if (state.begin < state.end) {
+          uint64_t bucket = (state.begin + state.end) / 2;
+          uint64_t sample = samples_[bucket];
+          if ((sample != state.sample) ? (sample < state.sample) :
+            (compare_header(bucket, state.query) <= 0)) {
+            state.begin = bucket + 1;
+          } else {
+            state.end = bucket;
+          }
+        }
+        if (state.begin < state.end) {
+          __builtin_prefetch(samples_.data() + (state.begin + state.end) / 2);
+        } else if (state.end == 0) {
+          // The query is less than the first key.
+          *state.id = -1;
+          state.done = true;
+        } else {
+          offsets_.prefetch(state.end - 1);
+          state.stage = LookupState::OFFSET;
+        }
+      }
+    });
+}
+
+void FrontCoding::reverse_lookup_batch(span<const uint64_t> ids,
+  span<string> keys) const {
+  assert(ids.size() == keys.size());
+  // A batch prefetches the offsets of its buckets, then their bytes, and
+  // then decodes them.
+  for (uint64_t begin = 0; begin < ids.size(); begin += BATCH_WIDTH) {
+    uint64_t end = min(begin + BATCH_WIDTH, (uint64_t)ids.size());
+    for (uint64_t i = begin; i < end; ++i) {
+      assert(ids[i] < n_keys());
+      offsets_.prefetch(ids[i] / bucket_size_);
+    }
+    for (uint64_t i = begin; i < end; ++i) {
+      __builtin_prefetch(bytes_.data() + offsets_[ids[i] / bucket_size_]);
+    }
+    for (uint64_t i = begin; i < end; ++i) {
+      reverse_lookup(ids[i], keys[i]);
+    }
+  }
+}
+
+bool FrontCoding::Cursor::next() {
+  if (pending_) {
+    pending_ = false;
+    return true;
+  }
+  if (done_ || !decode()) {
+    done_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool FrontCoding::Cursor::decode() {
+  uint64_t id = id_ + 1;
+  if (id >= trie_->n_keys_) {
+    return false;
+  }
+  const uint8_t *ptr = trie_->bytes_.data() + pos_;
+  uint64_t lcp, length;
+  if (id % trie_->bucket_size_ == 0) {
+    length = decode_vbyte(ptr);
+    lcp = common_prefix(key_.data(), ptr, min((uint64_t)key_.length(),
+      length));
+    if (lcp < min_length_) {
+      return false;
+    }
+    key_.assign(reinterpret_cast<const char *>(ptr), length);
+  } else {
+    lcp = decode_vbyte(ptr);
+    length = decode_vbyte(ptr);
+    if (lcp < min_length_) {
+      return false;
+    }
+    key_.resize(lcp);
+    key_.append(reinterpret_cast<const char *>(ptr), length);
+  }
+  pos_ = (ptr + length) - trie_->bytes_.data();
+  id_ = id;
+  return true;
+}
+
+void FrontCoding::predictive_search(string_view prefix,
+  Cursor &cursor) const {
+  // The keys after the first one with the prefix have the prefix while
+  // they share as many bytes with the key before them.
+  lower_bound(prefix, cursor);
+  if (cursor.pending_ && !cursor.key_.starts_with(prefix)) {
+    cursor.pending_ = false;
+    cursor.done_ = true;
+  }
+  cursor.min_length_ = prefix.length();
+}
+
+void FrontCoding::lower_bound(string_view query, Cursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.key_.clear();
+  cursor.min_length_ = 0;
+  cursor.pending_ = false;
+  cursor.done_ = true;
+  if (n_keys_ == 0) {
+    return;
+  }
+  uint64_t bucket = find_bucket(query, 0, n_buckets());
+  if (bucket == (uint64_t)-1) {
+    bucket = 0;
+  }
+  cursor.id_ = (bucket * bucket_size_) - 1;
+  cursor.pos_ = offsets_[bucket];
+  do {
+    if (!cursor.decode()) {
+      return;
+    }
+  } while (cursor.key_ < query);
+  cursor.pending_ = true;
+  cursor.done_ = false;
+}
+
+// next() looks up the prefixes of the query from the shortest. The buckets
+// of a prefix are those before the query and not before the last prefix.
+bool FrontCoding::PrefixCursor::next() {
+  while (next_length_ <= max_length_) {
+    string_view prefix = query_.substr(0, next_length_++);
+    uint64_t bucket = trie_->find_bucket(prefix, begin_, end_);
+    if (bucket == (uint64_t)-1) {
+      continue;
+    }
+    begin_ = bucket;
+    uint64_t match;
+    uint64_t id = trie_->find_in_bucket(bucket, prefix, match);
+    if (id != (uint64_t)-1) {
+      length_ = prefix.length();
+      id_ = id;
+      return true;
+    }
+  }
+  return false;
+}
+
+void FrontCoding::common_prefix_search(string_view query,
+  PrefixCursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.query_ = query;
+  cursor.next_length_ = 0;
+  cursor.max_length_ = 0;
+  cursor.begin_ = 0;
+  cursor.end_ = 0;
+  cursor.length_ = 0;
+  cursor.id_ = -1;
+  uint64_t bucket = find_bucket(query, 0, n_buckets());
+  if (bucket == (uint64_t)-1) {
+    cursor.next_length_ = 1;
+    return;
+  }
+  find_in_bucket(bucket, query, cursor.max_length_);
+  cursor.end_ = bucket + 1;
+}
+
+bool FrontCoding::save(const char *path) const {
+  Writer writer;
+  if (!writer.open(path)) {
+    return false;
+  }
+  writer.write_header(name());
+  bytes_.write(writer);
+  offsets_.write(writer);
+  samples_.write(writer);
+  writer.write(n_keys_);
+  writer.write(bucket_size_);
+  writer.write(size_);
+  writer.write(flags_);
+  return writer.close();
+}
+
+bool FrontCoding::map(const char *path) {
+  Mapper mapper;
+  if (!mapper.open(path) || !mapper.map_header(name())) {
+    return false;
+  }
+  // The file is mapped into a new dictionary, so that this one is kept if
+  // the file is broken.
+  FrontCoding trie;
+  trie.bytes_.map(mapper);
+  trie.offsets_.map(mapper);
+  trie.samples_.map(mapper);
+  mapper.map(trie.n_keys_);
+  mapper.map(trie.bucket_size_);
+  mapper.map(trie.size_);
+  mapper.map(trie.flags_);
+  if (!mapper.ok()) {
+    return false;
+  }
+  trie.mapper_ = move(mapper);
+  *this = move(trie);
+  return true;
+}
+
+uint64_t FrontCoding::find_bucket(string_view query, uint64_t begin,
+  uint64_t end) const {
+  uint64_t first = begin;
+  uint64_t query_sample = sample(query);
+  while (begin < end) {
+    uint64_t bucket = (begin + end) / 2;
+    uint64_t sample = samples_[bucket];
+    if ((sample != query_sample) ? (sample < query_sample) :
+      (compare_header(bucket, query) <= 0)) {
+      begin = bucket + 1;
+    } else {
+      end = bucket;
+    }
+  }
+  return (begin != first) ? (begin - 1) : -1;
+}
+
+// find_in_bucket() keeps the common prefix of the query and the last key
+// less than it, so that a key is compared only if it shares as much with
+// the key before it. A key which shares less is greater than the query and
+// one which shares more is less.
+uint64_t FrontCoding::find_in_bucket(uint64_t bucket, string_view query,
+  uint64_t &match) const {
+  const uint8_t *ptr = bytes_.data() + offsets_[bucket];
+  uint64_t length = decode_vbyte(ptr);
+  match = common_prefix(ptr, query.data(),
+    min(length, (uint64_t)query.length()));
+  uint64_t id = bucket * bucket_size_;
+  if (match == length && match == query.length()) {
+    return id;
+  }
+  ptr += length;
+  uint64_t end = min(id + bucket_size_, n_keys_);
+  for (++id; id < end; ++id) {
+    uint64_t lcp = decode_vbyte(ptr);
+    length = decode_vbyte(ptr);
+    if (lcp < match) {
+      return -1;
+    } else if (lcp == match) {
+      uint64_t n = min(length, query.length() - lcp);
+      uint64_t i = common_prefix(ptr, query.data() + lcp, n);
+      if (i != n) {
+        if (ptr[i] > (uint8_t)query[lcp + i]) {
+          return -1;
+        }
+      } else if (length >= query.length() - lcp) {
+        if (length == query.length() - lcp) {
+          match = query.length();
+          return id;
+        }
+        return -1;
+      }
+      match = lcp + i;
+    }
+    ptr += length;
+  }
+  return -1;
+}
+
+int FrontCoding::compare_header(uint64_t bucket, string_view query) const {
+  const uint8_t *ptr = bytes_.data() + offsets_[bucket];
+  uint64_t length = decode_vbyte(ptr);
+  return compare(ptr, length, query);
+}
+
+}  // namespace trie_eval
@@ -0,0 +1,178 @@
+#ifndef FRONT_CODING_HPP
+#define FRONT_CODING_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "int-vector.hpp"
+#include "io.hpp"
+#include "trie-base.hpp"
+#include "vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// FrontCoding is a front-coded dictionary. Sorted keys are split into
+// buckets of bucket_size() keys. The first key of a bucket, its header, is
+// kept whole, and each of the others as the length of its common prefix
+// with the key before it and the rest of it. A lookup finds the bucket by
+// binary search over the headers and decodes the bucket in order. IDs are
+// in lexicographic order of keys.
+class FrontCoding : TrieBase {
+ public:
+  // The bucket size is given by flags (see trie_bucket_size()).
+  explicit FrontCoding(uint64_t flags = 0);
+  ~FrontCoding() {}
+
+  FrontCoding(FrontCoding &&) = default;
+  FrontCoding &operator=(FrontCoding &&) = default;
+
+  void build(const vector<string> &keys);
+  // build() with n_threads encodes the buckets on up to n_threads threads.
+  // The dictionary is the same as with one.
+  void build(const vector<string> &keys, uint64_t n_threads);
+
+  uint64_t lookup(const string &query) const;
+  void reverse_lookup(uint64_t id, string &key) const;
+
+  void lookup_batch(span<const string_view> queries,
+    span<uint64_t> ids) const;
+  void reverse_lookup_batch(span<const uint64_t> ids,
+    span<string> keys) const;
+
+  // Cursor enumerates keys in lexicographic order. key() is a buffer which
+  // is reused by next(), so no string is allocated per key.
+  class Cursor {
+   public:
+    Cursor()
+      : trie_(nullptr), key_(), id_(-1), pos_(0), min_length_(0),
+        pending_(false), done_(true) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    const string &key() const {
+      return key_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class FrontCoding;
+
+    const FrontCoding *trie_;
+    string key_;
+    uint64_t id_;
+    // pos_ is the position of the next key in bytes_. A key which shares
+    // less than min_length_ bytes with the key before it ends the cursor.
+    uint64_t pos_;
+    uint64_t min_length_;
+    // pending_ tells that key_ is found by a search and is not returned
+    // yet.
+    bool pending_;
+    bool done_;
+
+    // decode() moves on to the next key and returns false at the end.
+    bool decode();
+  };
+
+  // predictive_search() sets cursor to the keys which start with prefix.
+  void predictive_search(string_view prefix, Cursor &cursor) const;
+  // lower_bound() sets cursor to the keys which are not less than query.
+  void lower_bound(string_view query, Cursor &cursor) const;
+
+  // PrefixCursor enumerates the keys which are prefixes of a query in order
+  // of length.
+  class PrefixCursor {
+   public:
+    PrefixCursor()
+      : trie_(nullptr), query_(), next_length_(0), max_length_(0),
+        begin_(0), end_(0), length_(0), id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    // The key is the first length() bytes of the query.
+    uint64_t length() const {
+      return length_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class FrontCoding;
+
+    const FrontCoding *trie_;
+    string_view query_;
+    // A key which is a prefix of the query is not longer than max_length_,
+    // the common prefix of the query and the last key not greater than it,
+    // and is in buckets [begin_, end_).
+    uint64_t next_length_;
+    uint64_t max_length_;
+    uint64_t begin_;
+    uint64_t end_;
+    uint64_t length_;
+    uint64_t id_;
+  };
+
+  // common_prefix_search() sets cursor to the keys which are prefixes of
+  // query.
+  void common_prefix_search(string_view query, PrefixCursor &cursor) const;
+
+  bool save(const char *path) const;
+  bool map(const char *path);
+
+  const char *name() const {
+    return "Front coding";
+  }
+  uint64_t n_keys() const {
+    return n_keys_;
+  }
+  uint64_t bucket_size() const {
+    return bucket_size_;
+  }
+  uint64_t size() const {
+    return size_;
+  }
+  uint64_t flags() const {
+    return flags_;
+  }
+
+ private:
+  // bytes_ has the buckets in order and offsets_ has their positions. A
+  // header is its length and bytes, and another key is the length of its
+  // common prefix, the length of the rest and the rest, with lengths in
+  // VByte. samples_ has the first 8 bytes of the headers as big-endian
+  // integers, padded with 0s, so that most steps of a search compare
+  // integers and stay in one array.
+  Vector<uint8_t> bytes_;
+  IntVector offsets_;
+  Vector<uint64_t> samples_;
+  uint64_t n_keys_;
+  uint64_t bucket_size_;
+  uint64_t size_;
+  uint64_t flags_;
+  Mapper mapper_;
+
+  uint64_t n_buckets() const {
+    return samples_.size();
+  }
+  // find_bucket() returns the last bucket in [begin, end) whose header is
+  // not greater than query, or -1 if there is none.
+  uint64_t find_bucket(string_view query, uint64_t begin, uint64_t end) const;
+  // find_in_bucket() returns the ID of query in bucket, whose header is not
+  // greater than query, or -1. match is set to the length of the common
+  // prefix of query and the last key not greater than it.
+  uint64_t find_in_bucket(uint64_t bucket, string_view query,
+    uint64_t &match) const;
+  // compare_header() compares the header of bucket with query.
+  int compare_header(uint64_t bucket, string_view query) const;
+};
+
+}  // namespace trie_eval
+
+#endif  // FRONT_CODING_HPP
@@ -1,28 +1,92 @@
 #ifndef INT_VECTOR_HPP
 #define INT_VECTOR_HPP
 
+#include <x86intrin.h>
+
 #include <cassert>
 #include <cstdint>
-#include <vector>
+#include <cstring>
+#include <type_traits>
+
+#include "cpu.hpp"
+#include "vector.hpp"
 
 namespace trie_eval {
 
 using namespace std;
 
+// The AVX2 kernels of IntVector::decode() unpack 4 values at a time into
+// 64-bit lanes. Values of 8, 16 or 32 bits are zero-extended. Other widths
+// are gathered as unaligned words from their first bytes, which must be
+// followed by 8 readable bytes, and then shifted and masked per lane.
+// Values are read as bytes or vectors, which may alias the words.
+template <typename T>
+__attribute__((target("avx2")))
+inline void decode_aligned_avx2(const uint8_t *values, uint64_t n,
+  uint64_t *out) {
+  for (uint64_t i = 0; i + 4 <= n; i += 4) {
+    const uint8_t *bytes = values + (i * sizeof(T));
+    __m256i lanes;
+    if constexpr (sizeof(T) == 1) {
+      uint32_t word;
+      memcpy(&word, bytes, 4);
+      lanes = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(word));
+    } else if constexpr (sizeof(T) == 2) {
+      lanes = _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i *)bytes));
+    } else {
+      lanes = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)bytes));
+    }
+    _mm256_storeu_si256((__m256i *)(out + i), lanes);
+  }
+}
+
+__attribute__((target("avx2")))
+inline void decode_packed_avx2(const uint8_t *bytes, uint64_t n_bits,
+  uint64_t begin, uint64_t n, uint64_t *out) {
+  const __m256i mask = _mm256_set1_epi64x((1UL << n_bits) - 1);
+  const __m256i step = _mm256_set1_epi64x(n_bits * 4);
+  const __m256i low3 = _mm256_set1_epi64x(7);
+  __m256i pos = _mm256_setr_epi64x(begin * n_bits, (begin + 1) * n_bits,
+    (begin + 2) * n_bits, (begin + 3) * n_bits);
+  for (uint64_t i = 0; i + 4 <= n; i += 4) {
+    __m256i lanes = _mm256_i64gather_epi64((const long long *)bytes,
+      _mm256_srli_epi64(pos, 3), 1);
+    lanes = _mm256_srlv_epi64(lanes, _mm256_and_si256(pos, low3));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_and_si256(lanes, mask));
+    pos = _mm256_add_epi64(pos, step);
+  }
+}
+
 struct IntVector {
-  vector<uint64_t> words;
+  Vector<uint64_t> words;
   uint64_t n_ints;
   uint64_t n_bits;
   uint64_t mask;
 
-  IntVector() : words(), n_ints(0), n_bits(0) {}
+  IntVector() : words(), n_ints(0), n_bits(0), mask(0) {}
   ~IntVector() {}
 
+  // stored_bits() returns the width in which values of width bits are
+  // stored. A width of 8, 16 or 32 bits has byte-aligned fast paths, so a
+  // width up to 1/8 narrower is rounded up to it.
+  static uint64_t stored_bits(uint64_t width) {
+    for (uint64_t aligned : { 8, 16, 32 }) {
+      if (width <= aligned && width * 9 >= aligned * 8) {
+        return aligned;
+      }
+    }
+    return width;
+  }
+
+  // init() chooses the width for max_value. mask keeps the bits of that
+  // width, so set() and add() store the same values whether or not the
+  // width is rounded up.
   void init(uint64_t n, uint64_t max_value) {
     words.clear();
     n_ints = n;
-    n_bits = (max_value != 0) ? (64 - __builtin_clzll(max_value)) : 1;
-    mask = (1UL << n_bits) - 1;
+    uint64_t width = (max_value != 0) ? (64 - __builtin_clzll(max_value)) : 1;
+    n_bits = stored_bits(width);
+    mask = (width < 64) ? ((1UL << width) - 1) : ~0UL;
     words.resize((n * n_bits + 63) / 64, 0);
   }
 
@@ -30,7 +94,49 @@ struct IntVector {
     return sizeof(uint64_t) * words.size();
   }
 
+  void write(Writer &writer) const {
+    words.write(writer);
+    writer.write(n_ints);
+    writer.write(n_bits);
+    writer.write(mask);
+  }
+  void map(Mapper &mapper) {
+    words.map(mapper);
+    mapper.map(n_ints);
+    mapper.map(n_bits);
+    mapper.map(mask);
+  }
+
+  // get<N>() is operator[] for n_bits == N, which is 8, 16 or 32. Words
+  // are little-endian, so a value is an aligned element of the words.
+  // Other widths stay on the shifts and masks of operator[], which is
+  // faster than dispatching on the width through a table of get<N>().
+  template <uint64_t N>
+  uint64_t get(uint64_t i) const {
+    static_assert(N == 8 || N == 16 || N == 32);
+    assert(i < n_ints);
+    assert(n_bits == N);
+    if constexpr (N == 8) {
+      return reinterpret_cast<const uint8_t *>(words.data())[i];
+    } else {
+      // Only bytes may alias the words, so wider values are copied out.
+      using T = conditional_t<N == 16, uint16_t, uint32_t>;
+      T value;
+      memcpy(&value, reinterpret_cast<const uint8_t *>(words.data()) +
+        (i * sizeof(T)), sizeof(T));
+      return value;
+    }
+  }
+
   uint64_t operator[](uint64_t i) const {
+    switch (n_bits) {
+      case 8:
+        return get<8>(i);
+      case 16:
+        return get<16>(i);
+      case 32:
+        return get<32>(i);
+    }
     assert(i < n_ints);
     const std::size_t pos = i * n_bits;
     const std::size_t id = pos / 64;
@@ -42,6 +148,49 @@ struct IntVector {
       return ((words[id] >> offset) | (words[id + 1] << (64 - offset))) & mask;
     }
   }
+  void prefetch(uint64_t i) const {
+    __builtin_prefetch(words.data() + ((i * n_bits) / 64));
+  }
+
+  // decode() writes the values in [begin, end) to out. With AVX2, 4 values
+  // are unpacked at a time, and the rest go through operator[].
+  void decode(uint64_t begin, uint64_t end, uint64_t *out) const {
+    assert(begin <= end);
+    assert(end <= n_ints);
+    uint64_t i = begin;
+    if (CPU.avx2) {
+      const uint8_t *bytes = reinterpret_cast<const uint8_t *>(words.data());
+      uint64_t n = end - begin;
+      switch (n_bits) {
+        case 8:
+          decode_aligned_avx2<uint8_t>(bytes + begin, n, out);
+          break;
+        case 16:
+          decode_aligned_avx2<uint16_t>(bytes + (begin * 2), n, out);
+          break;
+        case 32:
+          decode_aligned_avx2<uint32_t>(bytes + (begin * 4), n, out);
+          break;
+        default:
+          // The last gather reads 8 bytes from the first byte of its value.
+          if (n_bits <= 57) {
+            uint64_t n_bytes = words.size() * 8;
+            while (n >= 4 && ((begin + n - 1) * n_bits / 8) + 8 > n_bytes) {
+              --n;
+            }
+            decode_packed_avx2(bytes, n_bits, begin, n, out);
+          } else {
+            n = 0;
+          }
+          break;
+      }
+      i += n - (n % 4);
+    }
+    for ( ; i < end; ++i) {
+      out[i - begin] = (*this)[i];
+    }
+  }
+
   void set(uint64_t i, uint64_t value) {
     assert(i < n_ints);
     const std::size_t pos = i * n_bits;
@@ -56,18 +205,24 @@ struct IntVector {
     }
   }
 
+  // reserve() allocates words for n values, so that adding up to n values
+  // does not reallocate.
+  void reserve(uint64_t n) {
+    words.reserve(((n * n_bits) + 63) / 64);
+  }
+
+  // add() appends value. The bits past the last value are 0, so a new
+  // value is ORed in without masking the words first.
   void add(uint64_t value) {
     const std::size_t pos = n_ints * n_bits;
     const std::size_t id = pos / 64;
     const std::size_t offset = pos % 64;
 
-    if ((pos / 64) != ((pos + n_bits) / 64)) {
+    if ((words.size() * 64) < (pos + n_bits)) {
       words.push_back(0);
     }
-    words[id] &= ~(mask << offset);
     words[id] |= (value & mask) << offset;
     if ((offset + n_bits) > 64) {
-      words[id + 1] &= ~(mask >> (64 - offset));
       words[id + 1] |= (value & mask) >> (64 - offset);
     }
     ++n_ints;
@@ -0,0 +1,216 @@
+#ifndef IO_HPP
+#define IO_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace trie_eval {
+
+using namespace std;
+
+// Files start with a fixed header followed by the name of the engine which
+// wrote them. Integers are stored in the native byte order and every array
+// starts at an aligned offset so that a mapped file can be used in place.
+// FILE_VERSION changes with every change of the layout, so that map()
+// rejects files of other versions instead of misreading them:
+//   1: The first layout.
+//   2: BitVector writes its interleaved lines.
+//   3: Trie writes bitmaps for its dense top levels.
+//   4: CompressedBitVector writes its encoding and its Elias-Fano and
+//      RRR parts.
+//   5: Indirect writes its links as a DacVector.
+//   6: Patricia and Indirect write their tails as a TailPool.
+//   7: TailPool writes its layout and a nested trie.
+//   8: TailPool writes its symbol table.
+const char FILE_MAGIC[8] = { 'T', 'r', 'i', 'e', 'E', 'v', 'a', 'l' };
+const uint64_t FILE_VERSION = 8;
+
+class Writer {
+ public:
+  Writer() : file_(nullptr), offset_(0), ok_(false) {}
+  ~Writer() {
+    close();
+  }
+
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+
+  bool open(const char *path) {
+    close();
+    file_ = fopen(path, "wb");
+    offset_ = 0;
+    ok_ = (file_ != nullptr);
+    return ok_;
+  }
+  bool close() {
+    if (file_ != nullptr) {
+      if (fclose(file_) != 0) {
+        ok_ = false;
+      }
+      file_ = nullptr;
+    }
+    return ok_;
+  }
+
+  void write(const void *data, uint64_t size) {
+    if (ok_ && size != 0 && fwrite(data, 1, size, file_) != size) {
+      ok_ = false;
+    }
+    offset_ += size;
+  }
+  template <typename T>
+  void write(const T &value) {
+    write(&value, sizeof(T));
+  }
+  void align(uint64_t n) {
+    static const uint8_t zeros[64] = {};
+    assert(n <= sizeof(zeros));
+    write(zeros, (n - (offset_ % n)) % n);
+  }
+
+  void write_header(const char *name) {
+    uint64_t length = strlen(name);
+    write(FILE_MAGIC, sizeof(FILE_MAGIC));
+    write(FILE_VERSION);
+    write(length);
+    write(name, length);
+    align(8);
+  }
+
+ private:
+  FILE *file_;
+  uint64_t offset_;
+  bool ok_;
+};
+
+class Mapper {
+ public:
+  Mapper() : addr_(nullptr), size_(0), offset_(0), ok_(false) {}
+  ~Mapper() {
+    close();
+  }
+
+  Mapper(const Mapper &) = delete;
+  Mapper &operator=(const Mapper &) = delete;
+  Mapper(Mapper &&rhs)
+    : addr_(rhs.addr_), size_(rhs.size_), offset_(rhs.offset_), ok_(rhs.ok_) {
+    rhs.addr_ = nullptr;
+    rhs.size_ = 0;
+  }
+  Mapper &operator=(Mapper &&rhs) {
+    if (this != &rhs) {
+      close();
+      addr_ = rhs.addr_;
+      size_ = rhs.size_;
+      offset_ = rhs.offset_;
+      ok_ = rhs.ok_;
+      rhs.addr_ = nullptr;
+      rhs.size_ = 0;
+    }
+    return *this;
+  }
+
+  // The mapping is shared and read-only, so processes mapping the same file
+  // share its pages in the page cache.
+  bool open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    addr_ = static_cast<uint8_t *>(addr);
+    size_ = st.st_size;
+    offset_ = 0;
+    ok_ = true;
+    return true;
+  }
+  void close() {
+    if (addr_ != nullptr) {
+      munmap(addr_, size_);
+      addr_ = nullptr;
+      size_ = 0;
+    }
+    ok_ = false;
+  }
+
+  bool ok() const {
+    return ok_;
+  }
+  // remaining() returns the number of bytes left to map.
+  uint64_t remaining() const {
+    return ok_ ? (size_ - offset_) : 0;
+  }
+  // check() makes ok() false unless condition, which validates a value read
+  // from the file, holds.
+  bool check(bool condition) {
+    if (!condition) {
+      ok_ = false;
+    }
+    return ok_;
+  }
+
+  // map_bytes() returns a pointer to the next size bytes, or nullptr if the
+  // file is too short, in which case ok() becomes false.
+  const void *map_bytes(uint64_t size) {
+    if (!ok_ || size > size_ - offset_) {
+      ok_ = false;
+      return nullptr;
+    }
+    const void *ptr = addr_ + offset_;
+    offset_ += size;
+    return ptr;
+  }
+  template <typename T>
+  void map(T &value) {
+    const void *ptr = map_bytes(sizeof(T));
+    if (ptr != nullptr) {
+      memcpy(&value, ptr, sizeof(T));
+    }
+  }
+  void align(uint64_t n) {
+    map_bytes((n - (offset_ % n)) % n);
+  }
+
+  bool map_header(const char *name) {
+    const void *magic = map_bytes(sizeof(FILE_MAGIC));
+    uint64_t version = 0;
+    uint64_t length = 0;
+    map(version);
+    map(length);
+    const void *str = map_bytes(length);
+    align(8);
+    if (!ok_ || memcmp(magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+        version != FILE_VERSION || length != strlen(name) ||
+        memcmp(str, name, length) != 0) {
+      ok_ = false;
+    }
+    return ok_;
+  }
+
+ private:
+  uint8_t *addr_;
+  uint64_t size_;
+  uint64_t offset_;
+  bool ok_;
+};
+
+}  // namespace trie_eval
+
+#endif  // IO_HPP
@@ -7,12 +7,21 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "trie.hpp"
 #include "patricia.hpp"
 #include "indirect.hpp"
 #include "tstree.hpp"
+#include "blocked-tstree.hpp"
+#include "double-array.hpp"
+#include "centroid-trie.hpp"
+#include "front-coding.hpp"
 
 namespace {
 
@@ -33,6 +42,21 @@ string uint_str(uint64_t v) {
   return str;
 }
 
+// thread_counts() returns the numbers of threads to build with: 1, 2 and
+// 3, which show differences from a serial build even on a single core, and
+// then powers of 2 up to the number of hardware threads.
+vector<uint64_t> thread_counts() {
+  vector<uint64_t> counts = { 1, 2, 3 };
+  uint64_t max_threads = thread::hardware_concurrency();
+  for (uint64_t n_threads = 4; n_threads < max_threads; n_threads *= 2) {
+    counts.push_back(n_threads);
+  }
+  if (max_threads > 3) {
+    counts.push_back(max_threads);
+  }
+  return counts;
+}
+
 void read_keys_from(istream &stream, vector<string> &keys,
   uint64_t &sum, uint64_t &min_len, uint64_t &max_len) {
   string line;
@@ -86,11 +110,36 @@ void sort_and_uniquify_keys(vector<string> &keys) {
     uint_str(sum).c_str(),  avg);
 }
 
+string flags_str(uint64_t flags) {
+  string str;
+  if (flags & TRIE_INTERLEAVED) {
+    str += " [interleaved]";
+  }
+  if (flags & TRIE_DENSE) {
+    str += " [dense]";
+  }
+  if (flags & TRIE_COMPRESSED) {
+    str += " [compressed]";
+  }
+  if (flags & TRIE_FSST_TAILS) {
+    str += " [fsst tails]";
+  }
+  if (flags & TRIE_NESTED_TAILS) {
+    str += " [nested tails x" + to_string((flags & TRIE_NESTED_TAILS) >> 3) +
+      "]";
+  }
+  if (flags & TRIE_BUCKET_SIZE) {
+    str += " [bucket size " +
+      to_string(1UL << ((flags & TRIE_BUCKET_SIZE) >> 6)) + "]";
+  }
+  return str;
+}
+
 template <typename T>
 void eval(const vector<string> &keys, const vector<string> &shuffled_keys,
-  const vector<uint64_t> shuffled_ids) {
-  T trie;
-  printf("%s:\n", trie.name());
+  const vector<uint64_t> shuffled_ids, uint64_t flags = 0) {
+  T trie(flags);
+  printf("%s%s:\n", trie.name(), flags_str(flags).c_str());
 
   high_resolution_clock::time_point begin = high_resolution_clock::now();
   trie.build(keys);
@@ -101,6 +150,26 @@ void eval(const vector<string> &keys, const vector<string> &shuffled_keys,
   printf(" build: elapsed = %.3f s (%.3f ns/key)\n",
     elapsed / 1000000000, elapsed / keys.size());
 
+  // build() with n_threads must give the same trie for any n_threads.
+  double serial_elapsed = 0.0;
+  for (uint64_t n_threads : thread_counts()) {
+    T parallel_trie(flags);
+    begin = high_resolution_clock::now();
+    parallel_trie.build(keys, n_threads);
+    end = high_resolution_clock::now();
+    elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+    if (n_threads == 1) {
+      serial_elapsed = elapsed;
+    }
+    printf(" build (%lu threads): %.3f s (%.3f ns/key, x%.2f)\n",
+      n_threads, elapsed / 1000000000, elapsed / keys.size(),
+      serial_elapsed / elapsed);
+    assert(parallel_trie.size() == trie.size());
+    for (auto it = keys.begin(); it != keys.end(); ++it) {
+      assert(parallel_trie.lookup(*it) == trie.lookup(*it));
+    }
+  }
+
   begin = high_resolution_clock::now();
   vector<pair<uint64_t, string>> pairs;
   for (auto it = keys.begin(); it != keys.end(); ++it) {
@@ -160,11 +229,401 @@ void eval(const vector<string> &keys, const vector<string> &shuffled_keys,
   elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
   printf(" reverse_lookup (shuffled): %.3f s (%.3f ns/key)\n",
     elapsed / 1000000000, elapsed / keys.size());
+
+  vector<string_view> queries(shuffled_keys.begin(), shuffled_keys.end());
+  vector<uint64_t> ids(queries.size());
+  begin = high_resolution_clock::now();
+  trie.lookup_batch(queries, ids);
+  end = high_resolution_clock::now();
+  elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+  printf(" lookup_batch (shuffled): %.3f s (%.3f ns/key)\n",
+    elapsed / 1000000000, elapsed / keys.size());
+  for (uint64_t i = 0; i < ids.size(); ++i) {
+    assert(ids[i] == trie.lookup(shuffled_keys[i]));
+  }
+
+  vector<string> batch_keys(shuffled_ids.size());
+  begin = high_resolution_clock::now();
+  trie.reverse_lookup_batch(shuffled_ids, batch_keys);
+  end = high_resolution_clock::now();
+  elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+  printf(" reverse_lookup_batch (shuffled): %.3f s (%.3f ns/key)\n",
+    elapsed / 1000000000, elapsed / keys.size());
+  for (uint64_t i = 0; i < batch_keys.size(); ++i) {
+    assert(batch_keys[i] == pairs[shuffled_ids[i]].second);
+  }
+
+  typename T::Cursor cursor;
+  trie.predictive_search("", cursor);
+  for (auto it = keys.begin(); it != keys.end(); ++it) {
+    bool found = cursor.next();
+    assert(found);
+    assert(cursor.key() == *it);
+    assert(cursor.id() == trie.lookup(cursor.key()));
+  }
+  assert(!cursor.next());
+
+  // Prefixes are the first 3/4 of the shuffled keys.
+  vector<string_view> prefixes;
+  for (auto it = shuffled_keys.begin(); it != shuffled_keys.end(); ++it) {
+    uint64_t length = (it->length() * 3 + 3) / 4;
+    prefixes.push_back(string_view(*it).substr(0, length));
+  }
+  uint64_t n_results = 0;
+  begin = high_resolution_clock::now();
+  for (auto it = prefixes.begin(); it != prefixes.end(); ++it) {
+    trie.predictive_search(*it, cursor);
+    while (cursor.next()) {
+      ++n_results;
+    }
+  }
+  end = high_resolution_clock::now();
+  elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+  printf(" predictive_search: %.3f s (%s results, %.3f results/us)\n",
+    elapsed / 1000000000, uint_str(n_results).c_str(),
+    n_results / (elapsed / 1000));
+  for (auto it = prefixes.begin(); it != prefixes.end(); ++it) {
+    auto key_it = lower_bound(keys.begin(), keys.end(), *it);
+    trie.predictive_search(*it, cursor);
+    while (cursor.next()) {
+      assert(cursor.key() == *key_it);
+      assert(cursor.id() == trie.lookup(cursor.key()));
+      ++key_it;
+    }
+    assert(key_it == keys.end() || !key_it->starts_with(*it));
+  }
+
+  if constexpr (requires { trie.lower_bound(string_view(), cursor); }) {
+    // A scan reads SCAN_LENGTH keys from the lower bound of a shuffled key.
+    const uint64_t SCAN_LENGTH = 100;
+    uint64_t n_scans = min((uint64_t)shuffled_keys.size(), (uint64_t)10000);
+    uint64_t n_scanned = 0, trie_sum = 0, vector_sum = 0;
+    begin = high_resolution_clock::now();
+    for (uint64_t i = 0; i < n_scans; ++i) {
+      trie.lower_bound(shuffled_keys[i], cursor);
+      for (uint64_t j = 0; j < SCAN_LENGTH && cursor.next(); ++j) {
+        trie_sum += cursor.key().length();
+        ++n_scanned;
+      }
+    }
+    end = high_resolution_clock::now();
+    elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+    printf(" lower_bound + scan: %.3f s (%.3f ns/key)\n",
+      elapsed / 1000000000, elapsed / n_scanned);
+    begin = high_resolution_clock::now();
+    for (uint64_t i = 0; i < n_scans; ++i) {
+      auto it = lower_bound(keys.begin(), keys.end(), shuffled_keys[i]);
+      for (uint64_t j = 0; j < SCAN_LENGTH && it != keys.end(); ++j, ++it) {
+        vector_sum += it->length();
+      }
+    }
+    end = high_resolution_clock::now();
+    elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+    printf(" lower_bound + scan (vector<string>): %.3f s (%.3f ns/key)\n",
+      elapsed / 1000000000, elapsed / n_scanned);
+    assert(trie_sum == vector_sum);
+
+    // Queries are also taken from the middle of keys and out of keys.
+    for (uint64_t i = 0; i < n_scans; ++i) {
+      string queries[4] = { shuffled_keys[i], shuffled_keys[i],
+        shuffled_keys[i], shuffled_keys[i].substr(0, i % 8) };
+      ++queries[1].back();
+      --queries[2].back();
+      for (const string &query : queries) {
+        auto it = lower_bound(keys.begin(), keys.end(), query);
+        trie.lower_bound(query, cursor);
+        for (uint64_t j = 0; j < 3 && it != keys.end(); ++j, ++it) {
+          bool found = cursor.next();
+          assert(found);
+          assert(cursor.key() == *it);
+          assert(cursor.id() == trie.lookup(*it));
+        }
+        if (it == keys.end()) {
+          assert(!cursor.next());
+        }
+      }
+    }
+  }
+
+  // The text is a concatenation of shuffled keys and a search starts at
+  // each of its bytes.
+  string text;
+  uint64_t max_length = 0;
+  for (auto it = shuffled_keys.begin(); it != shuffled_keys.end(); ++it) {
+    if (text.length() < (1 << 20)) {
+      text += *it;
+    }
+    max_length = max(max_length, (uint64_t)it->length());
+  }
+  typename T::PrefixCursor prefix_cursor;
+  uint64_t n_hits = 0;
+  begin = high_resolution_clock::now();
+  for (uint64_t i = 0; i < text.length(); ++i) {
+    trie.common_prefix_search(string_view(text).substr(i), prefix_cursor);
+    while (prefix_cursor.next()) {
+      ++n_hits;
+    }
+  }
+  end = high_resolution_clock::now();
+  elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+  printf(" common_prefix_search: %.3f s (%s hits, %.3f ns/byte)\n",
+    elapsed / 1000000000, uint_str(n_hits).c_str(), elapsed / text.length());
+  for (uint64_t i = 0; i < text.length(); i += 97) {
+    trie.common_prefix_search(string_view(text).substr(i), prefix_cursor);
+    uint64_t length = 0;
+    for ( ; i + length <= text.length() && length <= max_length; ++length) {
+      uint64_t id = trie.lookup(text.substr(i, length));
+      if (id != (uint64_t)-1) {
+        bool found = prefix_cursor.next();
+        assert(found);
+        assert(prefix_cursor.length() == length);
+        assert(prefix_cursor.id() == id);
+      }
+    }
+    assert(!prefix_cursor.next());
+  }
+
+  char path[] = "/tmp/trie-eval.XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd != -1);
+  close(fd);
+  begin = high_resolution_clock::now();
+  bool ok = trie.save(path);
+  assert(ok);
+  end = high_resolution_clock::now();
+  elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+  printf(" save: %.3f s\n", elapsed / 1000000000);
+
+  T mapped_trie;
+  begin = high_resolution_clock::now();
+  ok = mapped_trie.map(path);
+  assert(ok);
+  end = high_resolution_clock::now();
+  elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+  printf(" map: %.3f ms\n", elapsed / 1000000);
+  unlink(path);
+
+  // A truncated file is rejected and the mapped trie is kept.
+  char broken_path[] = "/tmp/trie-eval.XXXXXX";
+  fd = mkstemp(broken_path);
+  assert(fd != -1);
+  close(fd);
+  struct stat st;
+  ok = trie.save(broken_path) && (stat(broken_path, &st) == 0) &&
+    (truncate(broken_path, st.st_size / 2) == 0);
+  assert(ok);
+  ok = mapped_trie.map(broken_path);
+  assert(!ok);
+  unlink(broken_path);
+  assert(mapped_trie.size() == trie.size());
+  assert(mapped_trie.flags() == trie.flags());
+  for (auto it = pairs.begin(); it != pairs.end(); ++it) {
+    assert(mapped_trie.lookup(it->second) == it->first);
+    mapped_trie.reverse_lookup(it->first, key);
+    assert(key == it->second);
+  }
+}
+
+// eval_bit_vector() builds a random bit vector on the thread_counts() and
+// checks that the indexes are the same.
+void eval_bit_vector() {
+  const uint64_t n_bits = 1UL << 28;
+  BitVector bv;
+  bv.resize(n_bits);
+  for (uint64_t i = 0; i < bv.words.size(); ++i) {
+    bv.words[i] = ((uint64_t)random() << 33) ^ ((uint64_t)random() << 2) ^
+      random();
+  }
+  printf("bit_vector:\n");
+  printf(" #bits: %s\n", uint_str(n_bits).c_str());
+  BitVector serial_bv;
+  double serial_elapsed = 0.0;
+  for (uint64_t n_threads : thread_counts()) {
+    BitVector parallel_bv = bv;
+    auto begin = high_resolution_clock::now();
+    parallel_bv.build(BitVector::SELECT0 | BitVector::SELECT1, n_threads);
+    auto end = high_resolution_clock::now();
+    double elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+    if (n_threads == 1) {
+      serial_elapsed = elapsed;
+      serial_bv = move(parallel_bv);
+    } else {
+      assert(parallel_bv.n_ones == serial_bv.n_ones);
+      for (uint64_t i = 0; i < serial_bv.ranks.size(); ++i) {
+        assert(parallel_bv.ranks[i].abs() == serial_bv.ranks[i].abs());
+        for (uint64_t j = 0; j < 3; ++j) {
+          assert(parallel_bv.ranks[i].rels[j] == serial_bv.ranks[i].rels[j]);
+        }
+      }
+      assert(parallel_bv.select0s.size() == serial_bv.select0s.size());
+      for (uint64_t i = 0; i < serial_bv.select0s.size(); ++i) {
+        assert(parallel_bv.select0s[i] == serial_bv.select0s[i]);
+      }
+      assert(parallel_bv.select1s.size() == serial_bv.select1s.size());
+      for (uint64_t i = 0; i < serial_bv.select1s.size(); ++i) {
+        assert(parallel_bv.select1s[i] == serial_bv.select1s[i]);
+      }
+    }
+    printf(" build (%lu threads): %.3f ms (%.3f ns/word, x%.2f)\n",
+      n_threads, elapsed / 1000000, elapsed / (n_bits / 64),
+      serial_elapsed / elapsed);
+  }
+}
+
+// eval_int_vector() sets random values, which are wider than the width of
+// the vector, reads them with operator[] and decode() and checks that they
+// are masked to the width.
+void eval_int_vector() {
+  const uint64_t n_ints = 1UL << 22;
+  printf("int_vector:\n");
+  printf(" #ints: %s\n", uint_str(n_ints).c_str());
+  vector<uint64_t> values(n_ints);
+  vector<uint64_t> decoded(n_ints);
+  for (uint64_t width : { 5, 8, 15, 16, 21, 30, 32, 45 }) {
+    uint64_t max_value = (1UL << width) - 1;
+    IntVector iv;
+    iv.init(n_ints, max_value);
+    for (uint64_t i = 0; i < n_ints; ++i) {
+      uint64_t value = ((uint64_t)random() << 33) ^ random();
+      iv.set(i, value);
+      values[i] = value & max_value;
+    }
+    auto begin = high_resolution_clock::now();
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < n_ints; ++i) {
+      total += iv[i];
+    }
+    auto end = high_resolution_clock::now();
+    double get_elapsed =
+      (double)duration_cast<nanoseconds>(end - begin).count();
+    begin = high_resolution_clock::now();
+    iv.decode(0, n_ints, decoded.data());
+    end = high_resolution_clock::now();
+    double decode_elapsed =
+      (double)duration_cast<nanoseconds>(end - begin).count();
+    uint64_t decoded_total = 0;
+    for (uint64_t i = 0; i < n_ints; ++i) {
+      assert(decoded[i] == values[i]);
+      decoded_total += decoded[i];
+    }
+    assert(decoded_total == total);
+    iv.decode(3, n_ints - 5, decoded.data());
+    for (uint64_t i = 3; i < n_ints - 5; ++i) {
+      assert(decoded[i - 3] == values[i]);
+    }
+    printf(" %lu bits (%lu stored): operator[] = %.3f ns/int, "
+      "decode = %.3f ns/int\n", width, iv.n_bits, get_elapsed / n_ints,
+      decode_elapsed / n_ints);
+  }
+}
+
+// eval_weighted_tstree() builds TSTree with the counts of keys in a Zipf
+// query log as weights and compares its lookups of another Zipf query
+// stream with those of TSTree without weights.
+void eval_weighted_tstree(const vector<string> &keys,
+  const vector<string> &shuffled_keys) {
+  const uint64_t n_queries = 1 << 20;
+  // The i-th shuffled key is queried in proportion to 1 / (i + 1).
+  vector<double> cdf(shuffled_keys.size());
+  double total = 0.0;
+  for (uint64_t i = 0; i < cdf.size(); ++i) {
+    total += 1.0 / (i + 1);
+    cdf[i] = total;
+  }
+  auto sample = [&]() {
+    double x = (double)random() / RAND_MAX * total;
+    uint64_t rank = lower_bound(cdf.begin(), cdf.end(), x) - cdf.begin();
+    return min(rank, (uint64_t)cdf.size() - 1);
+  };
+  vector<uint64_t> weights(keys.size(), 0);
+  for (uint64_t i = 0; i < n_queries; ++i) {
+    const string &key = shuffled_keys[sample()];
+    ++weights[lower_bound(keys.begin(), keys.end(), key) - keys.begin()];
+  }
+  vector<const string *> queries(n_queries);
+  for (uint64_t i = 0; i < n_queries; ++i) {
+    queries[i] = &shuffled_keys[sample()];
+  }
+
+  TSTree trie;
+  trie.build(keys);
+  TSTree weighted_trie;
+  printf("%s [weighted by zipf queries]:\n", weighted_trie.name());
+  auto begin = high_resolution_clock::now();
+  weighted_trie.build(keys, weights);
+  auto end = high_resolution_clock::now();
+  double elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+  printf(" size: %s bytes (%.3f bytes/key)\n",
+    uint_str(weighted_trie.size()).c_str(),
+    (double)weighted_trie.size() / keys.size());
+  printf(" build: elapsed = %.3f s (%.3f ns/key)\n",
+    elapsed / 1000000000, elapsed / keys.size());
+
+  for (uint64_t n_threads : thread_counts()) {
+    TSTree parallel_trie;
+    parallel_trie.build(keys, weights, n_threads);
+    assert(parallel_trie.size() == weighted_trie.size());
+    for (auto it = keys.begin(); it != keys.end(); ++it) {
+      assert(parallel_trie.lookup(*it) == weighted_trie.lookup(*it));
+    }
+  }
+  // The weight of "cac" comes before any node of its part is added.
+  vector<string> few_keys = { "a", "cac", "cc" };
+  vector<uint64_t> few_weights = { 1, 1, 0 };
+  TSTree serial_trie;
+  serial_trie.build(few_keys, few_weights, 1);
+  TSTree parallel_trie;
+  parallel_trie.build(few_keys, few_weights, 2);
+  for (auto it = few_keys.begin(); it != few_keys.end(); ++it) {
+    assert(parallel_trie.lookup(*it) == serial_trie.lookup(*it));
+  }
+  vector<bool> found_ids(keys.size(), false);
+  string key;
+  for (auto it = keys.begin(); it != keys.end(); ++it) {
+    uint64_t id = weighted_trie.lookup(*it);
+    assert(id < keys.size() && !found_ids[id]);
+    found_ids[id] = true;
+    weighted_trie.reverse_lookup(id, key);
+    assert(key == *it);
+  }
+  TSTree::Cursor cursor;
+  weighted_trie.predictive_search("", cursor);
+  for (auto it = keys.begin(); it != keys.end(); ++it) {
+    bool found = cursor.next();
+    assert(found);
+    assert(cursor.key() == *it);
+  }
+  assert(!cursor.next());
+
+  const TSTree *tries[] = { &trie, &weighted_trie };
+  const char *names[] = { "without weights", "with weights" };
+  for (uint64_t i = 0; i < 2; ++i) {
+    begin = high_resolution_clock::now();
+    for (const string *query : queries) {
+      tries[i]->lookup(*query);
+    }
+    end = high_resolution_clock::now();
+    double zipf_elapsed =
+      (double)duration_cast<nanoseconds>(end - begin).count();
+    begin = high_resolution_clock::now();
+    for (auto it = shuffled_keys.begin(); it != shuffled_keys.end(); ++it) {
+      tries[i]->lookup(*it);
+    }
+    end = high_resolution_clock::now();
+    elapsed = (double)duration_cast<nanoseconds>(end - begin).count();
+    printf(" lookup %s: zipf = %.3f ns/key, shuffled = %.3f ns/key\n",
+      names[i], zipf_elapsed / n_queries, elapsed / keys.size());
+  }
 }
 
 void run(int argc, char *argv[]) {
   ios_base::sync_with_stdio(false);
 
+  printf("select_in_word: %s\n", select_in_word_name());
+  printf("popcount_block: %s\n", popcount_block_name());
+  eval_bit_vector();
+  eval_int_vector();
+
   vector<string> keys = read_keys(argc, argv);
   sort_and_uniquify_keys(keys);
   vector<string> shuffled_keys = keys;
@@ -176,10 +635,35 @@ void run(int argc, char *argv[]) {
   });
   random_shuffle(shuffled_ids.begin(), shuffled_ids.end());
 
-  eval<Trie>(keys, shuffled_keys, shuffled_ids);
-  eval<Patricia>(keys, shuffled_keys, shuffled_ids);
-  eval<Indirect>(keys, shuffled_keys, shuffled_ids);
-  eval<TSTree>(keys, shuffled_keys, shuffled_ids);
+  const uint64_t layouts[] = { 0, TRIE_INTERLEAVED };
+  for (uint64_t flags : layouts) {
+    eval<Trie>(keys, shuffled_keys, shuffled_ids, flags);
+    eval<Trie>(keys, shuffled_keys, shuffled_ids, flags | TRIE_DENSE);
+    eval<Patricia>(keys, shuffled_keys, shuffled_ids, flags);
+    eval<Indirect>(keys, shuffled_keys, shuffled_ids, flags);
+    eval<CentroidTrie>(keys, shuffled_keys, shuffled_ids, flags);
+    eval<TSTree>(keys, shuffled_keys, shuffled_ids, flags);
+    eval<BlockedTSTree>(keys, shuffled_keys, shuffled_ids, flags);
+  }
+  eval<DoubleArray>(keys, shuffled_keys, shuffled_ids);
+  for (uint64_t bucket_size = 4; bucket_size <= 64; bucket_size *= 4) {
+    eval<FrontCoding>(keys, shuffled_keys, shuffled_ids,
+      trie_bucket_size(bucket_size));
+  }
+  eval<Trie>(keys, shuffled_keys, shuffled_ids, TRIE_COMPRESSED);
+  eval<Patricia>(keys, shuffled_keys, shuffled_ids, TRIE_COMPRESSED);
+  eval<Indirect>(keys, shuffled_keys, shuffled_ids, TRIE_COMPRESSED);
+  eval<TSTree>(keys, shuffled_keys, shuffled_ids, TRIE_COMPRESSED);
+  eval<BlockedTSTree>(keys, shuffled_keys, shuffled_ids, TRIE_COMPRESSED);
+  eval_weighted_tstree(keys, shuffled_keys);
+  eval<Patricia>(keys, shuffled_keys, shuffled_ids, TRIE_FSST_TAILS);
+  eval<Indirect>(keys, shuffled_keys, shuffled_ids, TRIE_FSST_TAILS);
+  for (uint64_t depth = 1; depth <= 2; ++depth) {
+    eval<Patricia>(keys, shuffled_keys, shuffled_ids,
+      trie_nested_tails(depth));
+    eval<Indirect>(keys, shuffled_keys, shuffled_ids,
+      trie_nested_tails(depth));
+  }
 }
 
 }  // namespace
@@ -0,0 +1,67 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace trie_eval {
+
+using namespace std;
+
+// parallel() calls f(i) for each i in [0, n) on up to n_threads threads.
+template <typename F>
+void parallel(uint64_t n_threads, uint64_t n, F f) {
+  n_threads = min(n_threads, n);
+  if (n_threads <= 1) {
+    for (uint64_t i = 0; i < n; ++i) {
+      f(i);
+    }
+    return;
+  }
+  atomic<uint64_t> next(0);
+  vector<thread> threads;
+  for (uint64_t i = 0; i < n_threads; ++i) {
+    threads.emplace_back([&]() {
+      for (uint64_t j = next++; j < n; j = next++) {
+        f(j);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+// split_keys() splits sorted keys into up to n_parts ranges of similar
+// sizes and returns their bounds. Keys with the same first byte go in the
+// same range, so the ranges share no node but the root and a trie is the
+// concatenation of the levels of their tries below the root.
+inline vector<uint64_t> split_keys(const vector<string> &keys,
+  uint64_t n_parts) {
+  vector<uint64_t> bounds(1, 0);
+  for (uint64_t i = 1; i < n_parts; ++i) {
+    uint64_t bound = max(keys.size() * i / n_parts, bounds.back());
+    if (bound == 0 || bound == keys.size()) {
+      continue;
+    }
+    if (!keys[bound - 1].empty()) {
+      uint8_t byte = keys[bound - 1][0];
+      bound = partition_point(keys.begin() + bound, keys.end(),
+        [byte](const string &key) { return (uint8_t)key[0] == byte; })
+        - keys.begin();
+    }
+    if (bound != bounds.back() && bound != keys.size()) {
+      bounds.push_back(bound);
+    }
+  }
+  bounds.push_back(keys.size());
+  return bounds;
+}
+
+}  // namespace trie_eval
+
+#endif  // PARALLEL_HPP
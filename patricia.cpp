@@ -1,170 +1,172 @@
 #include "patricia.hpp"
 
 #include <algorithm>
-#include <queue>
+
+#include "batch.hpp"
+#include "find-label.hpp"
+#include "parallel.hpp"
 
 namespace trie_eval {
 namespace {
 
-struct Trie {
-  struct Level {
-    BitVector louds;
-    BitVector outs;
-    vector<uint8_t> labels;
-    uint64_t offset;
-
-    Level() : louds(), outs(), labels(), offset(0) {}
-
-    uint64_t size() const {
-        return louds.size() + outs.size() + labels.size();
-    }
-  };
-
-  vector<Level> levels;
-  string last_key;
-  uint64_t n_keys;
-  uint64_t n_nodes;
-
-  Trie() : levels(2), last_key(), n_keys(0), n_nodes(1) {
-    levels[0].louds.add(0);
-    levels[0].louds.add(1);
-    levels[1].louds.add(1);
-    levels[0].outs.add(0);
-    levels[0].labels.push_back(' ');
-  }
-
-  void add(const std::string &key) {
-    assert(n_keys == 0 || key > last_key);
-    if (key.empty()) {
-      levels[0].outs.set(0, 1);
-      ++n_keys;
-      return;
-    }
-    if (key.length() + 1 >= levels.size()) {
-      levels.resize(key.length() + 2);
-    }
-    uint64_t i = 0;
-    for ( ; i < key.length(); ++i) {
-      uint8_t byte = key[i];
-      if ((i == last_key.length()) ||
-          (byte != levels[i + 1].labels.back())) {
-        levels[i + 1].louds.set(levels[i + 1].louds.n_bits - 1, 0);
-        levels[i + 1].louds.add(1);
-        levels[i + 1].outs.add(0);
-        levels[i + 1].labels.push_back(key[i]);
-        ++n_nodes;
-        break;
-      }
-    }
-    for (++i; i < key.length(); ++i) {
-      levels[i + 1].louds.add(0);
-      levels[i + 1].louds.add(1);
-      levels[i + 1].outs.add(0);
-      levels[i + 1].labels.push_back(key[i]);
-      ++n_nodes;
-    }
-    levels[i + 1].louds.add(1);
-    levels[i].outs.set(levels[i].outs.n_bits - 1, 1);
-    last_key = key;
-    ++n_keys;
-  }
-
-  void build() {
-    for (uint64_t i = 0; i < levels.size(); ++i) {
-      levels[i].louds.build();
-    }
-  }
+// Level has the ends of the nodes, the LOUDS bits and the links of a level,
+// which are filled back to front.
+struct Level {
+  uint64_t node_id;
+  uint64_t louds_pos;
+  uint64_t link_id;
+};
 
-  uint64_t size() const {
-    uint64_t size = 0;
-    for (uint64_t i = 0; i < levels.size(); ++i) {
-      const Level &level = levels[i];
-      size += level.louds.size();
-      size += level.outs.size();
-      size += level.labels.size();
-    }
-    return size;
-  }
+struct LookupState {
+  string_view query;
+  uint64_t *id;
+  uint64_t i;
+  uint64_t node_id;
+  uint64_t pos;
+  // query[i] has matched a node with a tail which is not matched yet.
+  bool link;
+  bool done;
 };
 
-struct Node {
-  uint64_t level_id:24;
-  uint64_t node_pos:40;
+struct ReverseLookupState {
+  string *key;
+  uint64_t node_id;
+  uint64_t pos;
+  // pos is a key id which has not been converted to a node yet.
+  bool outs;
+  bool link;
+  bool done;
 };
 
 }  // namespace
 
-Patricia::Patricia()
-  : louds_(), outs_(), links_(), labels_(), tail_bits_(), tail_bytes_(),
-    n_keys_(0), n_nodes_(0), size_(0) {}
+Patricia::Patricia(uint64_t flags)
+  : louds_(), outs_(), links_(), labels_(), tails_(), n_keys_(0),
+    n_nodes_(0), size_(0), flags_(flags), mapper_() {}
 
 void Patricia::build(const vector<string> &keys) {
-  Trie trie;
+  Builder builder(*this);
   for (auto it = keys.begin(); it != keys.end(); ++it) {
-    trie.add(*it);
+    builder.add(*it);
   }
-  trie.build();
+  builder.finish();
+}
 
-  louds_.add(0);
-  louds_.add(1);
-  outs_.add(trie.levels[0].outs[0]);
-  links_.add(0);
-  labels_.push_back(' ');
+void Patricia::Builder::finish() {
+  postorder_.finish();
+  trie_.build(span<const Postorder>(&postorder_, 1), 1);
+}
+
+void Patricia::build(const vector<string> &keys, uint64_t n_threads) {
+  vector<uint64_t> bounds = split_keys(keys, n_threads);
+  vector<Postorder> parts(bounds.size() - 1);
+  parallel(n_threads, parts.size(), [&](uint64_t part_id) {
+    for (uint64_t i = bounds[part_id]; i < bounds[part_id + 1]; ++i) {
+      parts[part_id].add(keys[i]);
+    }
+    parts[part_id].finish();
+  });
+  build(parts, n_threads);
+}
 
-  queue<Node> queue;
-  if (!trie.levels[1].louds[0]) {
-    queue.push(Node{ 1, 0 });
+// build() places the nodes of parts in level order. The parts share the
+// root, and a level below it is the concatenation of the levels of the
+// parts. The first pass counts the nodes of each level of each part and the
+// second fills them back to front, as the Reader gives them in reverse.
+void Patricia::build(span<const Postorder> parts, uint64_t n_threads) {
+  uint64_t bv_flags = 0;
+  if (flags_ & TRIE_INTERLEAVED) {
+    bv_flags |= BitVector::INTERLEAVED;
   }
-  while (!queue.empty()) {
-    Node node = queue.front();
-    if (node.level_id != 0) {
-      while (!trie.levels[node.level_id].louds[node.node_pos]) {
-        louds_.add(0);
-        uint64_t level_id = node.level_id;
-        uint64_t node_pos = node.node_pos;
-        uint64_t node_id = node_pos - trie.levels[level_id].louds.rank1(node_pos);
-        labels_.push_back(trie.levels[level_id].labels[node_id]);
-        for ( ; ; ) {
-          node_pos = (node_id == 0) ? 0 :
-            trie.levels[level_id + 1].louds.select1(node_id - 1) + 1;
-          if (trie.levels[level_id].outs[node_id] ||
-            !trie.levels[level_id + 1].louds[node_pos + 1]) {
-            break;
-          }
-          node_id = node_pos - node_id;
-          tail_bits_.add(level_id == node.level_id);
-          ++level_id;
-          tail_bytes_.push_back(trie.levels[level_id].labels[node_id]);
-        }
-        if (!trie.levels[level_id + 1].louds[node_pos]) {
-          queue.push(Node{ level_id + 1, node_pos });
-        } else {
-          queue.push(Node{ 0, 0 });
-        }
-        links_.add(level_id > node.level_id);
-        outs_.add(trie.levels[level_id].outs[node_id]);
-        ++node.node_pos;
-        ++node_id;
+  uint64_t cbv_flags = bv_flags;
+  if (flags_ & TRIE_COMPRESSED) {
+    cbv_flags |= BitVector::COMPRESSED;
+  }
+
+  // levels[part_id][depth - 1] is for the nodes at depth of a part.
+  vector<vector<Level>> levels(parts.size());
+  vector<Postorder::Node> roots(parts.size());
+  parallel(n_threads, parts.size(), [&](uint64_t part_id) {
+    Postorder::Node node;
+    Postorder::Reader reader(parts[part_id]);
+    reader.next(roots[part_id]);
+    while (reader.next(node)) {
+      if (node.depth > levels[part_id].size()) {
+        levels[part_id].push_back(Level{ 0, 0, 0 });
+      }
+      Level &level = levels[part_id][node.depth - 1];
+      ++level.node_id;
+      level.louds_pos += node.n_children + 1;
+      level.link_id += node.tail_length != 0;
+    }
+  });
+  bool root_out = false;
+  uint64_t n_root_children = 0;
+  uint64_t max_depth = 0;
+  for (uint64_t i = 0; i < parts.size(); ++i) {
+    root_out |= roots[i].out;
+    n_root_children += roots[i].n_children;
+    max_depth = max(max_depth, (uint64_t)levels[i].size());
+  }
+  Level end = { 1, n_root_children + 3, 0 };
+  for (uint64_t depth = 0; depth < max_depth; ++depth) {
+    for (uint64_t i = 0; i < parts.size(); ++i) {
+      if (depth < levels[i].size()) {
+        Level &level = levels[i][depth];
+        end.node_id += level.node_id;
+        end.louds_pos += level.louds_pos;
+        end.link_id += level.link_id;
+        level = end;
       }
     }
-    louds_.add(1);
-    queue.pop();
   }
 
-  louds_.build();
-  outs_.build();
-  links_.build();
-  tail_bits_.add(1);
-  tail_bits_.build();
+  louds_.resize(end.louds_pos);
+  louds_.set(1, 1);
+  louds_.set(n_root_children + 2, 1);
+  outs_.resize(end.node_id);
+  outs_.set(0, root_out);
+  links_.resize(end.node_id);
+  labels_.resize(end.node_id);
+  labels_[0] = ' ';
+  vector<string_view> tails(end.link_id);
+  parallel(n_threads, parts.size(), [&](uint64_t part_id) {
+    Postorder::Node node;
+    Postorder::Reader reader(parts[part_id]);
+    reader.next(node);
+    while (reader.next(node)) {
+      Level &level = levels[part_id][node.depth - 1];
+      uint64_t node_id = --level.node_id;
+      labels_[node_id] = node.label;
+      if (node.out) {
+        outs_.set_shared(node_id);
+      }
+      louds_.set_shared(--level.louds_pos);
+      level.louds_pos -= node.n_children;
+      if (node.tail_length != 0) {
+        links_.set_shared(node_id);
+        tails[--level.link_id] = string_view(
+          reinterpret_cast<const char *>(node.tail), node.tail_length);
+      }
+    }
+  });
 
-  n_keys_ = trie.n_keys;
+  louds_.build(bv_flags | BitVector::SELECT0 | BitVector::SELECT1,
+    n_threads);
+  outs_.build(cbv_flags | BitVector::SELECT1, n_threads);
+  links_.build(cbv_flags, n_threads);
+  tails_.build(tails, bv_flags, flags_);
+
+  n_keys_ = 0;
+  for (uint64_t i = 0; i < parts.size(); ++i) {
+    n_keys_ += parts[i].n_keys();
+  }
   n_nodes_ = outs_.n_bits;
   size_ = louds_.size();
   size_ += outs_.size();
   size_ += links_.size();
   size_ += labels_.size();
-  size_ += tail_bits_.size();
-  size_ += tail_bytes_.size();
+  size_ += tails_.size();
 }
 
 // uint64_t Patricia::lookup(const string &query) const {
@@ -207,49 +209,21 @@ uint64_t Patricia::lookup(const string &query) const {
   for (uint64_t i = 0; i < query.length(); ++i) {
     uint64_t node_pos = louds_.select1(node_id) + 1;
 
-    uint64_t end = node_pos;
-    uint64_t word = louds_.words[end / 64] >> (end % 64);
-    if (word == 0) {
-      end += 64 - (end % 64);
-      word = louds_.words[end / 64];
-      while (word == 0) {
-        end += 64;
-        word = louds_.words[end / 64];
-      }
-    }
-    end += __builtin_ctzll(word);
+    uint64_t end = louds_.next1(node_pos);
     uint64_t begin = node_pos - node_id - 1;
     end = begin + end - node_pos;
 
-    uint8_t byte = query[i];
-    while (begin < end) {
-      node_id = (begin + end) / 2;
-      if (byte < labels_[node_id]) {
-        end = node_id;
-      } else if (byte > labels_[node_id]) {
-        begin = node_id + 1;
-      } else {
-        if (links_[node_id]) {
-          uint64_t tail_pos = tail_bits_.select1(links_.rank1(node_id));
-          for (++i; i < query.length(); ++i) {
-            if (tail_bytes_[tail_pos] != (uint8_t)query[i]) {
-              return -1;
-            }
-            ++tail_pos;
-            if (tail_bits_[tail_pos]) {
-              break;
-            }
-          }
-          if (i == query.length()) {
-            return -1;
-          }
-        }
-        break;
-      }
-    }
-    if (begin >= end) {
+    node_id = find_label(labels_, begin, end, query[i]);
+    if (node_id == end) {
       return -1;
     }
+    if (links_[node_id]) {
+      ++i;
+      if (tails_.compare(tail_pos(node_id), query, i) != 0) {
+        return -1;
+      }
+      --i;
+    }
   }
   if (!outs_[node_id]) {
     return -1;
@@ -260,20 +234,421 @@ uint64_t Patricia::lookup(const string &query) const {
 void Patricia::reverse_lookup(uint64_t id, string &key) const {
   assert(id < n_keys());
   key.clear();
-  uint64_t node_id = outs_.select1(id);
+  restore(outs_.select1(id), key);
+  reverse(key.begin(), key.end());
+}
+
+void Patricia::lookup_batch(span<const string_view> queries,
+  span<uint64_t> ids) const {
+  assert(queries.size() == ids.size());
+  // match_tail() matches the tail which starts at pos against the rest of
+  // the query and moves i past it.
+  auto match_tail = [this](LookupState &state) {
+    ++state.i;
+    return tails_.compare(state.pos, state.query, state.i) == 0;
+  };
+  interleave<LookupState>(queries.size(),
+    [&](LookupState &state, uint64_t i) {
+      state.query = queries[i];
+      state.id = &ids[i];
+      state.i = 0;
+      state.node_id = 0;
+      state.link = false;
+      if (state.query.empty()) {
+        *state.id = outs_[0] ? outs_.rank1(0) : -1;
+        return false;
+      }
+      return true;
+    },
+    // A round moves each state on to a child and through its tail.
+    [&](LookupState *states, uint64_t n_states) {
+      for (uint64_t j = 0; j < n_states; ++j) {
+        louds_.prefetch_select1_sample(states[j].node_id);
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        louds_.prefetch_select1_block(states[j].node_id);
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        state.pos = louds_.select1(state.node_id) + 1;
+        louds_.prefetch(state.pos);
+        __builtin_prefetch(labels_.data() + state.pos - state.node_id - 1);
+        links_.prefetch(state.pos - state.node_id - 1);
+      }
+      uint64_t n_links = 0;
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        uint64_t end = louds_.next1(state.pos);
+        uint64_t begin = state.pos - state.node_id - 1;
+        end = begin + end - state.pos;
+
+        state.node_id = find_label(labels_, begin, end,
+          state.query[state.i]);
+        if (state.node_id == end) {
+          *state.id = -1;
+          state.done = true;
+        } else if (links_[state.node_id]) {
+          links_.prefetch_rank(state.node_id);
+          state.link = true;
+          ++n_links;
+        } else {
+          ++state.i;
+        }
+      }
+      if (n_links != 0) {
+        for (uint64_t j = 0; j < n_states; ++j) {
+          LookupState &state = states[j];
+          if (state.link) {
+            state.pos = links_.rank1(state.node_id);
+            tails_.prefetch(state.pos);
+          }
+        }
+        for (uint64_t j = 0; j < n_states; ++j) {
+          LookupState &state = states[j];
+          if (state.link) {
+            state.pos = tails_.pos(state.pos);
+            tails_.prefetch_bytes(state.pos);
+          }
+        }
+        for (uint64_t j = 0; j < n_states; ++j) {
+          LookupState &state = states[j];
+          if (state.link) {
+            state.link = false;
+            if (!match_tail(state)) {
+              *state.id = -1;
+              state.done = true;
+            }
+          }
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        const LookupState &state = states[j];
+        if (!state.done && state.i == state.query.length()) {
+          outs_.prefetch_rank(state.node_id);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        if (!state.done && state.i == state.query.length()) {
+          *state.id = outs_[state.node_id] ? outs_.rank1(state.node_id) : -1;
+          state.done = true;
+        }
+      }
+    });
+}
+
+void Patricia::reverse_lookup_batch(span<const uint64_t> ids,
+  span<string> keys) const {
+  assert(ids.size() == keys.size());
+  // enter() moves a state on to node_id or, at the root, finishes the key.
+  auto enter = [this](ReverseLookupState &state) {
+    if (state.node_id == 0) {
+      reverse(state.key->begin(), state.key->end());
+      state.done = true;
+    } else {
+      links_.prefetch(state.node_id);
+      __builtin_prefetch(labels_.data() + state.node_id);
+      louds_.prefetch_select0_sample(state.node_id);
+    }
+  };
+  interleave<ReverseLookupState>(ids.size(),
+    [&](ReverseLookupState &state, uint64_t i) {
+      assert(ids[i] < n_keys());
+      state.key = &keys[i];
+      state.key->clear();
+      state.pos = ids[i];
+      state.outs = true;
+      state.link = false;
+      outs_.prefetch_select1_sample(state.pos);
+      return true;
+    },
+    // A round moves each state up to the parent of its node.
+    [&](ReverseLookupState *states, uint64_t n_states) {
+      uint64_t n_links = 0;
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        if (!state.outs && links_[state.node_id]) {
+          links_.prefetch_rank(state.node_id);
+          state.link = true;
+          ++n_links;
+        }
+      }
+      if (n_links != 0) {
+        for (uint64_t j = 0; j < n_states; ++j) {
+          ReverseLookupState &state = states[j];
+          if (state.link) {
+            state.pos = links_.rank1(state.node_id);
+            tails_.prefetch(state.pos);
+          }
+        }
+        for (uint64_t j = 0; j < n_states; ++j) {
+          ReverseLookupState &state = states[j];
+          if (state.link) {
+            state.pos = tails_.pos(state.pos);
+            tails_.prefetch_bytes(state.pos);
+          }
+        }
+        for (uint64_t j = 0; j < n_states; ++j) {
+          ReverseLookupState &state = states[j];
+          if (state.link) {
+            tails_.append_reverse(state.pos, *state.key);
+            state.link = false;
+          }
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        if (!state.outs) {
+          state.key->push_back(labels_[state.node_id]);
+          louds_.prefetch_select0_block(state.node_id);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        if (!state.outs) {
+          uint64_t node_pos = louds_.select0(state.node_id);
+          state.node_id = node_pos - state.node_id - 1;
+          enter(state);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        const ReverseLookupState &state = states[j];
+        if (state.outs) {
+          outs_.prefetch_select1_block(state.pos);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        if (state.outs) {
+          state.node_id = outs_.select1(state.pos);
+          state.outs = false;
+          enter(state);
+        }
+      }
+    });
+}
+
+bool Patricia::Cursor::next() {
+  while (!stack_.empty()) {
+    Frame &frame = stack_.back();
+    if (frame.node_id == frame.end) {
+      stack_.pop_back();
+      continue;
+    }
+    uint64_t node_id = frame.node_id++;
+    key_.resize(frame.key_length);
+    if (node_id != 0) {
+      key_.push_back(trie_->labels_[node_id]);
+      if (trie_->links_[node_id]) {
+        trie_->tails_.append(trie_->tail_pos(node_id), key_);
+      }
+    }
+    uint64_t begin, end;
+    trie_->children(node_id, begin, end);
+    if (begin < end) {
+      stack_.push_back(Frame{ begin, end, key_.length() });
+    }
+    if (trie_->outs_[node_id]) {
+      id_ = trie_->outs_.rank1(node_id);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Patricia::predictive_search(string_view prefix, Cursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.stack_.clear();
+  cursor.key_.clear();
+  cursor.id_ = -1;
+  uint64_t node_id = 0;
+  uint64_t key_length = 0;
+  for (uint64_t i = 0; i < prefix.length(); ) {
+    node_id = find_child(node_id, prefix[i]);
+    if (node_id == (uint64_t)-1) {
+      return;
+    }
+    key_length = i++;
+    if (links_[node_id]) {
+      // The prefix may end in the middle of the tail.
+      if (tails_.compare(tail_pos(node_id), prefix, i) != 0 &&
+        i != prefix.length()) {
+        return;
+      }
+    }
+  }
+  cursor.key_.assign(prefix.substr(0, key_length));
+  cursor.stack_.push_back(Cursor::Frame{ node_id, node_id + 1, key_length });
+}
+
+void Patricia::lower_bound(string_view query, Cursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.stack_.clear();
+  cursor.key_.clear();
+  cursor.id_ = -1;
+  // The stack gets the siblings on the right of the path of the query,
+  // which are greater than the query, from the root down.
+  uint64_t node_id = 0;
+  uint64_t key_length = 0;
+  uint64_t i = 0;
+  for ( ; ; ) {
+    if (i == query.length()) {
+      // The query is the key of node_id.
+      cursor.stack_.push_back(
+        Cursor::Frame{ node_id, node_id + 1, key_length });
+      break;
+    }
+    uint64_t begin, end;
+    children(node_id, begin, end);
+    uint64_t n_children = end;
+    uint8_t byte = query[i];
+    while (begin < end) {
+      uint64_t child_id = (begin + end) / 2;
+      if (byte > labels_[child_id]) {
+        begin = child_id + 1;
+      } else {
+        end = child_id;
+      }
+    }
+    if (begin == n_children) {
+      break;
+    } else if (labels_[begin] != byte) {
+      cursor.stack_.push_back(Cursor::Frame{ begin, n_children, i });
+      break;
+    } else if (begin + 1 != n_children) {
+      cursor.stack_.push_back(Cursor::Frame{ begin + 1, n_children, i });
+    }
+    node_id = begin;
+    key_length = i++;
+    if (links_[node_id]) {
+      int cmp = tails_.compare(tail_pos(node_id), query, i);
+      if (cmp > 0) {
+        // The key of node_id is greater than the query.
+        cursor.stack_.push_back(
+          Cursor::Frame{ node_id, node_id + 1, key_length });
+      }
+      if (cmp != 0) {
+        break;
+      }
+    }
+  }
+  cursor.key_.assign(query.substr(0, i));
+}
+
+bool Patricia::PrefixCursor::next() {
+  while (node_id_ != (uint64_t)-1) {
+    uint64_t node_id = node_id_;
+    length_ = pos_;
+    // Move on to the child which matches the query, if any.
+    node_id_ = -1;
+    if (pos_ < query_.length()) {
+      uint64_t child_id = trie_->find_child(node_id, query_[pos_]);
+      if (child_id != (uint64_t)-1) {
+        ++pos_;
+        if (trie_->links_[child_id] && trie_->tails_.compare(
+          trie_->tail_pos(child_id), query_, pos_) != 0) {
+          child_id = -1;
+        }
+        node_id_ = child_id;
+      }
+    }
+    if (trie_->outs_[node_id]) {
+      id_ = trie_->outs_.rank1(node_id);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Patricia::common_prefix_search(string_view query,
+  PrefixCursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.query_ = query;
+  cursor.node_id_ = 0;
+  cursor.pos_ = 0;
+  cursor.length_ = 0;
+  cursor.id_ = -1;
+}
+
+bool Patricia::save(const char *path) const {
+  Writer writer;
+  if (!writer.open(path)) {
+    return false;
+  }
+  writer.write_header(name());
+  write(writer);
+  return writer.close();
+}
+
+bool Patricia::map(const char *path) {
+  Mapper mapper;
+  if (!mapper.open(path) || !mapper.map_header(name())) {
+    return false;
+  }
+  // The file is mapped into a new trie, so that this one is kept if the
+  // file is broken.
+  Patricia trie;
+  trie.map(mapper);
+  if (!mapper.ok()) {
+    return false;
+  }
+  trie.mapper_ = move(mapper);
+  *this = move(trie);
+  return true;
+}
+
+void Patricia::write(Writer &writer) const {
+  louds_.write(writer);
+  outs_.write(writer);
+  links_.write(writer);
+  labels_.write(writer);
+  tails_.write(writer);
+  writer.write(n_keys_);
+  writer.write(n_nodes_);
+  writer.write(size_);
+  writer.write(flags_);
+}
+
+void Patricia::map(Mapper &mapper) {
+  louds_.map(mapper);
+  outs_.map(mapper);
+  links_.map(mapper);
+  labels_.map(mapper);
+  tails_.map(mapper);
+  mapper.map(n_keys_);
+  mapper.map(n_nodes_);
+  mapper.map(size_);
+  mapper.map(flags_);
+}
+
+void Patricia::children(uint64_t node_id, uint64_t &begin,
+  uint64_t &end) const {
+  uint64_t node_pos = louds_.select1(node_id) + 1;
+  end = louds_.next1(node_pos);
+  begin = node_pos - node_id - 1;
+  end = begin + end - node_pos;
+}
+
+uint64_t Patricia::find_child(uint64_t node_id, uint8_t byte) const {
+  uint64_t begin, end;
+  children(node_id, begin, end);
+  uint64_t child_id = find_label(labels_, begin, end, byte);
+  return (child_id != end) ? child_id : -1;
+}
+
+void Patricia::restore(uint64_t node_id, string &key) const {
   while (node_id != 0) {
     if (links_[node_id]) {
-      uint64_t tail_id = links_.rank1(node_id);
-      uint64_t tail_pos = tail_bits_.select1(tail_id + 1);
-      do {
-        key.push_back(tail_bytes_[--tail_pos]);
-      } while (!tail_bits_[tail_pos]);
+      tails_.append_reverse(tail_pos(node_id), key);
     }
     key.push_back(labels_[node_id]);
     uint64_t node_pos = louds_.select0(node_id);
     node_id = node_pos - node_id - 1;
   }
-  reverse(key.begin(), key.end());
+}
+
+uint64_t Patricia::tail_pos(uint64_t node_id) const {
+  return tails_.pos(links_.rank1(node_id));
 }
 
 }  // namespace trie_eval
@@ -2,6 +2,9 @@
 #define PATRICIA_HPP
 
 #include "bit-vector.hpp"
+#include "compressed-bit-vector.hpp"
+#include "postorder.hpp"
+#include "tail-pool.hpp"
 #include "trie-base.hpp"
 
 namespace trie_eval {
@@ -10,14 +13,117 @@ using namespace std;
 
 class Patricia : TrieBase {
  public:
-  Patricia();
+  explicit Patricia(uint64_t flags = 0);
   ~Patricia() {}
 
+  Patricia(Patricia &&) = default;
+  Patricia &operator=(Patricia &&) = default;
+
+  // Builder builds a trie from keys given one at a time in sorted order, so
+  // that they need not be in memory at once.
+  class Builder {
+   public:
+    explicit Builder(Patricia &trie) : trie_(trie), postorder_() {}
+
+    void add(string_view key) {
+      postorder_.add(key);
+    }
+    void finish();
+
+   private:
+    Patricia &trie_;
+    Postorder postorder_;
+  };
+
   void build(const vector<string> &keys);
+  // build() with n_threads splits keys by their first bytes and builds the
+  // parts on up to n_threads threads. The trie is the same as with one.
+  void build(const vector<string> &keys, uint64_t n_threads);
 
   uint64_t lookup(const string &query) const;
   void reverse_lookup(uint64_t id, string &key) const;
 
+  void lookup_batch(span<const string_view> queries,
+    span<uint64_t> ids) const;
+  void reverse_lookup_batch(span<const uint64_t> ids,
+    span<string> keys) const;
+
+  // Cursor enumerates keys in lexicographic order. key() is a buffer which
+  // is reused by next(), so no string is allocated per key.
+  class Cursor {
+   public:
+    Cursor() : trie_(nullptr), stack_(), key_(), id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    const string &key() const {
+      return key_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class Patricia;
+
+    // Frame is a range of siblings which are not visited yet.
+    struct Frame {
+      uint64_t node_id;
+      uint64_t end;
+      uint64_t key_length;
+    };
+
+    const Patricia *trie_;
+    vector<Frame> stack_;
+    string key_;
+    uint64_t id_;
+  };
+
+  // predictive_search() sets cursor to the keys which start with prefix.
+  void predictive_search(string_view prefix, Cursor &cursor) const;
+  // lower_bound() sets cursor to the keys which are not less than query.
+  void lower_bound(string_view query, Cursor &cursor) const;
+
+  // PrefixCursor enumerates the keys which are prefixes of a query in order
+  // of length.
+  class PrefixCursor {
+   public:
+    PrefixCursor()
+      : trie_(nullptr), query_(), node_id_(-1), pos_(0), length_(0),
+        id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    // The key is the first length() bytes of the query.
+    uint64_t length() const {
+      return length_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class Patricia;
+
+    const Patricia *trie_;
+    string_view query_;
+    // node_id_ is the next node to visit and the first pos_ bytes of the
+    // query are its key.
+    uint64_t node_id_;
+    uint64_t pos_;
+    uint64_t length_;
+    uint64_t id_;
+  };
+
+  // common_prefix_search() sets cursor to the keys which are prefixes of
+  // query.
+  void common_prefix_search(string_view query, PrefixCursor &cursor) const;
+
+  bool save(const char *path) const;
+  bool map(const char *path);
+
   const char *name() const {
     return "LOUDS trie + labels";
   }
@@ -30,17 +136,40 @@ class Patricia : TrieBase {
   uint64_t size() const {
     return size_;
   }
+  uint64_t flags() const {
+    return flags_;
+  }
 
  private:
+  // A nested Patricia of TailPool is built and read through the members.
+  friend struct TailPool;
+
   BitVector louds_;
-  BitVector outs_;
-  BitVector links_;
-  vector<uint8_t> labels_;
-  BitVector tail_bits_;
-  vector<uint8_t> tail_bytes_;
+  CompressedBitVector outs_;
+  CompressedBitVector links_;
+  Vector<uint8_t> labels_;
+  TailPool tails_;
   uint64_t n_keys_;
   uint64_t n_nodes_;
   uint64_t size_;
+  uint64_t flags_;
+  Mapper mapper_;
+
+  void build(span<const Postorder> parts, uint64_t n_threads);
+  // write() and map() are save() and map() without the file, so that a
+  // nested trie is kept in the file of its parent.
+  void write(Writer &writer) const;
+  void map(Mapper &mapper);
+
+  // children() sets [begin, end) to the IDs of the children of node_id.
+  void children(uint64_t node_id, uint64_t &begin, uint64_t &end) const;
+  // find_child() returns the ID of the child of node_id labeled byte or -1.
+  uint64_t find_child(uint64_t node_id, uint8_t byte) const;
+  // restore() appends the labels and tails on the path from node_id up to
+  // the root, which is the key of node_id in reverse order.
+  void restore(uint64_t node_id, string &key) const;
+  // tail_pos() returns the position of the tail of node_id in tails_.
+  uint64_t tail_pos(uint64_t node_id) const;
 };
 
 }  // namespace trie_eval
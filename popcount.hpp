@@ -0,0 +1,90 @@
+#ifndef POPCOUNT_HPP
+#define POPCOUNT_HPP
+
+#include <x86intrin.h>
+
+#include <cstdint>
+
+#include "cpu.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// popcount_block(words, counts) sets counts[j] to the number of 1s in
+// words[j] for a block of 4 words, as BitVector::build() needs per-word
+// counts for its ranks. There are three kernels and the fastest one for the
+// running CPU is chosen at startup.
+enum PopcountBlock {
+  POPCOUNT_AVX512,
+  POPCOUNT_AVX2,
+  POPCOUNT_SCALAR,
+};
+
+__attribute__((target("avx512vpopcntdq,avx512vl")))
+inline void popcount_block_avx512(const uint64_t *words, uint64_t *counts) {
+  __m256i block = _mm256_loadu_si256((const __m256i *)words);
+  _mm256_storeu_si256((__m256i *)counts, _mm256_popcnt_epi64(block));
+}
+
+// The AVX2 kernel looks up the counts of nibbles with VPSHUFB and sums the
+// bytes of each word with VPSADBW (Mula, Kurz and Lemire, "Faster
+// population counts using AVX2 instructions", 2018).
+__attribute__((target("avx2")))
+inline void popcount_block_avx2(const uint64_t *words, uint64_t *counts) {
+  const __m256i table = _mm256_setr_epi8(
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  __m256i block = _mm256_loadu_si256((const __m256i *)words);
+  __m256i lo = _mm256_and_si256(block, nibble);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble);
+  __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(table, lo),
+    _mm256_shuffle_epi8(table, hi));
+  _mm256_storeu_si256((__m256i *)counts,
+    _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+}
+
+inline void popcount_block_scalar(const uint64_t *words, uint64_t *counts) {
+  for (uint64_t j = 0; j < 4; ++j) {
+    counts[j] = __builtin_popcountll(words[j]);
+  }
+}
+
+inline PopcountBlock choose_popcount_block() {
+  if (CPU.avx512_vpopcntdq) {
+    return POPCOUNT_AVX512;
+  }
+  return CPU.avx2 ? POPCOUNT_AVX2 : POPCOUNT_SCALAR;
+}
+
+inline const PopcountBlock POPCOUNT_BLOCK = choose_popcount_block();
+
+inline const char *popcount_block_name() {
+  switch (POPCOUNT_BLOCK) {
+    case POPCOUNT_AVX512:
+      return "avx512";
+    case POPCOUNT_AVX2:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
+
+inline void popcount_block(const uint64_t *words, uint64_t *counts) {
+  switch (POPCOUNT_BLOCK) {
+    case POPCOUNT_AVX512:
+      popcount_block_avx512(words, counts);
+      return;
+    case POPCOUNT_AVX2:
+      popcount_block_avx2(words, counts);
+      return;
+    default:
+      popcount_block_scalar(words, counts);
+      return;
+  }
+}
+
+}  // namespace trie_eval
+
+#endif  // POPCOUNT_HPP
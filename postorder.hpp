@@ -0,0 +1,225 @@
+#ifndef POSTORDER_HPP
+#define POSTORDER_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bit-vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// Postorder builds a Patricia trie from keys given in sorted order and
+// keeps its nodes in post-order. A node has a label and a tail, the labels
+// of the chain of non-terminal nodes with one child each which follow it.
+// Only the path of the last key is kept uncompressed, so memory stays near
+// the size of the nodes.
+//
+// Keys may have weights, such as their query counts, and the weight of a
+// node is the sum over the keys below it. Weights are kept only once a key
+// has a nonzero weight, and the nodes emitted before it get 0.
+//
+// In post-order, nodes at the same depth are in lexicographic order, and so
+// are any two nodes of which neither is an ancestor of the other. Engines
+// read the nodes back to front with a Reader, which also gives the depth of
+// each node, and place them in level order.
+class Postorder {
+ public:
+  struct Node {
+    uint8_t label;
+    bool out;
+    uint64_t n_children;
+    const uint8_t *tail;
+    uint64_t tail_length;
+    uint64_t depth;
+    // The node is the sibling_id-th of the n_siblings children of its
+    // parent. The root has no siblings.
+    uint64_t sibling_id;
+    uint64_t n_siblings;
+    uint64_t weight;
+  };
+
+  // Reader reads the nodes in reverse post-order. A node comes after its
+  // parent, and nodes at the same depth come in reverse lexicographic
+  // order.
+  class Reader {
+   public:
+    explicit Reader(const Postorder &postorder)
+      : postorder_(postorder), node_id_(postorder.labels_.size()),
+        degree_pos_(postorder.degrees_.n_bits),
+        tail_pos_(postorder.tail_bytes_.size()), stack_() {}
+
+    bool next(Node &node) {
+      if (node_id_ == 0) {
+        return false;
+      }
+      --node_id_;
+      node.label = postorder_.labels_[node_id_];
+      node.out = postorder_.outs_[node_id_];
+      // A degree is stored as a 1 followed by as many 0s.
+      uint64_t end = degree_pos_;
+      while (!postorder_.degrees_[--degree_pos_]) {}
+      node.n_children = end - degree_pos_ - 1;
+      node.tail = nullptr;
+      node.tail_length = 0;
+      if (postorder_.links_[node_id_]) {
+        end = tail_pos_;
+        while (!postorder_.tail_bits_[--tail_pos_]) {}
+        node.tail = postorder_.tail_bytes_.data() + tail_pos_;
+        node.tail_length = end - tail_pos_;
+      }
+
+      node.weight = postorder_.weighted_ ? postorder_.weights_[node_id_] : 0;
+
+      while (!stack_.empty() && stack_.back().n_left == 0) {
+        stack_.pop_back();
+      }
+      node.depth = stack_.size();
+      node.sibling_id = 0;
+      node.n_siblings = 0;
+      if (!stack_.empty()) {
+        node.sibling_id = --stack_.back().n_left;
+        node.n_siblings = stack_.back().n_children;
+      }
+      stack_.push_back(Parent{ node.n_children, node.n_children });
+      return true;
+    }
+
+   private:
+    struct Parent {
+      uint64_t n_children;
+      uint64_t n_left;
+    };
+
+    const Postorder &postorder_;
+    uint64_t node_id_;
+    uint64_t degree_pos_;
+    uint64_t tail_pos_;
+    vector<Parent> stack_;
+  };
+
+  Postorder()
+    : labels_(), outs_(), links_(), degrees_(), tail_bits_(), tail_bytes_(),
+      weights_(), weighted_(false), path_(1, Entry{ ' ', false, 0, 0 }),
+      last_key_(), chain_(), n_keys_(0) {}
+  ~Postorder() {}
+
+  void add(string_view key, uint64_t weight = 0) {
+    assert(n_keys_ == 0 || key > last_key_);
+    uint64_t depth = 0;
+    while (depth < key.length() && depth < last_key_.length() &&
+      key[depth] == last_key_[depth]) {
+      ++depth;
+    }
+    pop(depth);
+    if (depth < key.length()) {
+      ++path_.back().n_children;
+      for (uint64_t i = depth; i < key.length(); ++i) {
+        path_.push_back(Entry{ (uint8_t)key[i], false,
+          (uint64_t)(i + 1 < key.length()), 0 });
+      }
+    }
+    path_.back().out = true;
+    path_.back().weight += weight;
+    if (weight != 0 && !weighted_) {
+      weights_.resize(labels_.size(), 0);
+      weighted_ = true;
+    }
+    last_key_.assign(key);
+    ++n_keys_;
+  }
+
+  // finish() adds the nodes on the path of the last key and the root.
+  void finish() {
+    pop(0);
+    const Entry &root = path_.back();
+    chain_.clear();
+    emit(root.label, root.out, root.n_children, root.weight);
+    path_.clear();
+  }
+
+  uint64_t n_keys() const {
+    return n_keys_;
+  }
+  uint64_t n_nodes() const {
+    return labels_.size();
+  }
+  bool weighted() const {
+    return weighted_;
+  }
+
+ private:
+  // Entry is an uncompressed node on the path of the last key.
+  struct Entry {
+    uint8_t label;
+    bool out;
+    uint64_t n_children;
+    uint64_t weight;
+  };
+
+  vector<uint8_t> labels_;
+  BitVector outs_;
+  BitVector links_;
+  BitVector degrees_;
+  BitVector tail_bits_;
+  vector<uint8_t> tail_bytes_;
+  vector<uint64_t> weights_;
+  // weighted_ tells that weights_ has the weight of every node. It is set
+  // by the first nonzero weight, which may come before any node is emitted.
+  bool weighted_;
+  vector<Entry> path_;
+  string last_key_;
+  // chain_ is the tail of the node being popped in reverse order.
+  string chain_;
+  uint64_t n_keys_;
+
+  // pop() adds the nodes deeper than depth, which get no more children. A
+  // node whose parent will have one child and is not terminal is merged
+  // into the parent's tail instead. The weight of a node goes to its parent.
+  void pop(uint64_t depth) {
+    chain_.clear();
+    bool out = false;
+    uint64_t n_children = 0;
+    while (path_.size() > depth + 1) {
+      Entry entry = path_.back();
+      path_.pop_back();
+      if (chain_.empty()) {
+        out = entry.out;
+        n_children = entry.n_children;
+      }
+      Entry &parent = path_.back();
+      parent.weight += entry.weight;
+      if (path_.size() == depth + 1 || path_.size() == 1 || parent.out ||
+        parent.n_children != 1) {
+        emit(entry.label, out, n_children, entry.weight);
+        chain_.clear();
+      } else {
+        chain_.push_back(entry.label);
+      }
+    }
+  }
+
+  void emit(uint8_t label, bool out, uint64_t n_children, uint64_t weight) {
+    if (weighted_) {
+      weights_.push_back(weight);
+    }
+    labels_.push_back(label);
+    outs_.add(out);
+    degrees_.add(1);
+    degrees_.append_run(0, n_children);
+    links_.add(!chain_.empty());
+    if (!chain_.empty()) {
+      tail_bits_.add(1);
+      tail_bits_.append_run(0, chain_.length() - 1);
+      tail_bytes_.insert(tail_bytes_.end(), chain_.rbegin(), chain_.rend());
+    }
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // POSTORDER_HPP
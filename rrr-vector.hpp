@@ -0,0 +1,245 @@
+#ifndef RRR_VECTOR_HPP
+#define RRR_VECTOR_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "bit-vector.hpp"
+#include "int-vector.hpp"
+#include "select-in-word.hpp"
+#include "vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+struct RrrTable {
+  // binomials[n][k] is n choose k, and widths[k] is the number of bits of
+  // an offset of a block with k 1s.
+  uint16_t binomials[16][16];
+  uint8_t widths[16];
+
+  constexpr RrrTable() : binomials(), widths() {
+    for (uint64_t n = 0; n < 16; ++n) {
+      binomials[n][0] = 1;
+      for (uint64_t k = 1; k <= n; ++k) {
+        binomials[n][k] = binomials[n - 1][k - 1] +
+          ((k < n) ? binomials[n - 1][k] : 0);
+      }
+    }
+    for (uint64_t k = 0; k < 16; ++k) {
+      while ((1U << widths[k]) < binomials[15][k]) {
+        ++widths[k];
+      }
+    }
+  }
+};
+
+inline constexpr RrrTable RRR_TABLE;
+
+// RrrVector is a compressed bit vector for bits of medium density (Raman,
+// Raman and Rao, "Succinct indexable dictionaries with applications to
+// encoding k-ary trees and multisets", 2002). The bits are cut into blocks
+// of 15, and a block is stored as its class, the number of its 1s, and its
+// offset, its index among the blocks of the class, which takes fewer bits
+// the farther the class is from 7 or 8. Every 32 blocks, the number of 1s
+// and the position of the offset are sampled, and queries decode the
+// classes from the previous sample.
+struct RrrVector {
+  static const uint64_t BLOCK_SIZE = 15;
+  static const uint64_t SAMPLE_INTERVAL = 32;
+
+  IntVector classes;
+  Vector<uint64_t> offsets;
+  IntVector rank_samples;
+  IntVector offset_samples;
+  uint64_t n_bits;
+  uint64_t n_ones;
+
+  RrrVector()
+    : classes(), offsets(), rank_samples(), offset_samples(), n_bits(0),
+      n_ones(0) {}
+  ~RrrVector() {}
+
+  // build() encodes the bits of bv, which need not be built.
+  void build(const BitVector &bv) {
+    n_bits = bv.n_bits;
+    n_ones = 0;
+    uint64_t n_blocks = (n_bits + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint64_t n_samples = (n_blocks / SAMPLE_INTERVAL) + 1;
+    vector<uint64_t> ranks(n_samples);
+    vector<uint64_t> positions(n_samples);
+    classes.init(n_blocks, 15);
+    uint64_t n_offset_bits = 0;
+    for (uint64_t block_id = 0; block_id < n_blocks; ++block_id) {
+      if (block_id % SAMPLE_INTERVAL == 0) {
+        ranks[block_id / SAMPLE_INTERVAL] = n_ones;
+        positions[block_id / SAMPLE_INTERVAL] = n_offset_bits;
+      }
+      uint64_t block = get_bits(bv, block_id * BLOCK_SIZE);
+      uint64_t n_pops = __builtin_popcountll(block);
+      classes.set(block_id, n_pops);
+      uint64_t width = RRR_TABLE.widths[n_pops];
+      uint64_t offset = encode(block);
+      while (offsets.size() * 64 < n_offset_bits + width) {
+        offsets.push_back(0);
+      }
+      if (width != 0) {
+        offsets[n_offset_bits / 64] |= offset << (n_offset_bits % 64);
+        if ((n_offset_bits % 64) + width > 64) {
+          offsets[(n_offset_bits / 64) + 1] |=
+            offset >> (64 - (n_offset_bits % 64));
+        }
+      }
+      n_offset_bits += width;
+      n_ones += n_pops;
+    }
+    // The last sample is for select1(), which looks for the sample before
+    // the first with more 1s.
+    if (n_blocks % SAMPLE_INTERVAL == 0) {
+      ranks[n_samples - 1] = n_ones;
+      positions[n_samples - 1] = n_offset_bits;
+    }
+    offsets.push_back(0);
+    rank_samples.init(n_samples, n_ones);
+    offset_samples.init(n_samples, n_offset_bits);
+    for (uint64_t i = 0; i < n_samples; ++i) {
+      rank_samples.set(i, ranks[i]);
+      offset_samples.set(i, positions[i]);
+    }
+  }
+
+  uint64_t size() const {
+    return classes.size() + (sizeof(uint64_t) * offsets.size()) +
+      rank_samples.size() + offset_samples.size();
+  }
+
+  void write(Writer &writer) const {
+    classes.write(writer);
+    offsets.write(writer);
+    rank_samples.write(writer);
+    offset_samples.write(writer);
+    writer.write(n_bits);
+    writer.write(n_ones);
+  }
+  void map(Mapper &mapper) {
+    classes.map(mapper);
+    offsets.map(mapper);
+    rank_samples.map(mapper);
+    offset_samples.map(mapper);
+    mapper.map(n_bits);
+    mapper.map(n_ones);
+  }
+
+  uint64_t operator[](uint64_t i) const {
+    assert(i < n_bits);
+    uint64_t rank;
+    uint64_t block = find(i / BLOCK_SIZE, rank);
+    return (block >> (i % BLOCK_SIZE)) & 1;
+  }
+
+  void prefetch_rank(uint64_t i) const {
+    classes.prefetch((i / BLOCK_SIZE) & ~(SAMPLE_INTERVAL - 1));
+  }
+  void prefetch_select1_sample(uint64_t) const {}
+  void prefetch_select1_block(uint64_t) const {}
+
+  uint64_t rank1(uint64_t i) const {
+    assert(i <= n_bits);
+    if (i == n_bits) {
+      return n_ones;
+    }
+    uint64_t rank;
+    uint64_t block = find(i / BLOCK_SIZE, rank);
+    return rank + __builtin_popcountll(
+      block & ((1UL << (i % BLOCK_SIZE)) - 1));
+  }
+  uint64_t select1(uint64_t i) const {
+    assert(i < n_ones);
+    uint64_t begin = 0;
+    uint64_t end = rank_samples.n_ints;
+    while (begin + 1 < end) {
+      uint64_t middle = (begin + end) / 2;
+      if (i < rank_samples[middle]) {
+        end = middle;
+      } else {
+        begin = middle;
+      }
+    }
+    uint64_t block_id = begin * SAMPLE_INTERVAL;
+    i -= rank_samples[begin];
+    uint64_t pos = offset_samples[begin];
+    for ( ; ; ++block_id) {
+      uint64_t n_pops = classes[block_id];
+      if (i < n_pops) {
+        uint64_t block = decode(n_pops, read(pos, RRR_TABLE.widths[n_pops]));
+        return (block_id * BLOCK_SIZE) + select_in_word(block, i);
+      }
+      i -= n_pops;
+      pos += RRR_TABLE.widths[n_pops];
+    }
+  }
+
+ private:
+  static uint64_t get_bits(const BitVector &bv, uint64_t pos) {
+    uint64_t bits = bv.word(pos / 64) >> (pos % 64);
+    if ((pos % 64) + BLOCK_SIZE > 64 && (pos / 64) + 1 < bv.words.size()) {
+      bits |= bv.word((pos / 64) + 1) << (64 - (pos % 64));
+    }
+    bits &= (1UL << BLOCK_SIZE) - 1;
+    if (pos + BLOCK_SIZE > bv.n_bits) {
+      bits &= (1UL << (bv.n_bits - pos)) - 1;
+    }
+    return bits;
+  }
+
+  // encode() returns the offset of a block, which is the sum of
+  // binomials[p][k] for its k-th 1 at p, counting from 1.
+  static uint64_t encode(uint64_t block) {
+    uint64_t offset = 0;
+    for (uint64_t k = 1; block != 0; ++k, block &= block - 1) {
+      offset += RRR_TABLE.binomials[__builtin_ctzll(block)][k];
+    }
+    return offset;
+  }
+  static uint64_t decode(uint64_t n_pops, uint64_t offset) {
+    uint64_t block = 0;
+    uint64_t pos = BLOCK_SIZE - 1;
+    for (uint64_t k = n_pops; k != 0; --k, --pos) {
+      while (RRR_TABLE.binomials[pos][k] > offset) {
+        --pos;
+      }
+      block |= 1UL << pos;
+      offset -= RRR_TABLE.binomials[pos][k];
+    }
+    return block;
+  }
+
+  uint64_t read(uint64_t pos, uint64_t width) const {
+    uint64_t bits = offsets[pos / 64] >> (pos % 64);
+    if ((pos % 64) + width > 64) {
+      bits |= offsets[(pos / 64) + 1] << (64 - (pos % 64));
+    }
+    return bits & ((1UL << width) - 1);
+  }
+
+  // find() returns the bits of a block and sets rank to the number of 1s
+  // before it.
+  uint64_t find(uint64_t block_id, uint64_t &rank) const {
+    uint64_t sample_id = block_id / SAMPLE_INTERVAL;
+    rank = rank_samples[sample_id];
+    uint64_t pos = offset_samples[sample_id];
+    for (uint64_t i = sample_id * SAMPLE_INTERVAL; i < block_id; ++i) {
+      uint64_t n_pops = classes[i];
+      rank += n_pops;
+      pos += RRR_TABLE.widths[n_pops];
+    }
+    uint64_t n_pops = classes[block_id];
+    return decode(n_pops, read(pos, RRR_TABLE.widths[n_pops]));
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // RRR_VECTOR_HPP
@@ -0,0 +1,124 @@
+#ifndef SELECT_IN_WORD_HPP
+#define SELECT_IN_WORD_HPP
+
+#include <x86intrin.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "cpu.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// select_in_word(word, i) returns the position of the i-th (0-based) 1 in
+// word. There are three kernels and the fastest one for the running CPU is
+// chosen at startup. TRIE_EVAL_SELECT=pdep|broadword|table overrides it.
+enum SelectInWord {
+  SELECT_PDEP,
+  SELECT_BROADWORD,
+  SELECT_TABLE,
+};
+
+__attribute__((target("bmi2")))
+inline uint64_t select_in_word_pdep(uint64_t word, uint64_t i) {
+  return __builtin_ctzll(_pdep_u64(1UL << i, word));
+}
+
+// MSBs of bytes of x which are less than or equal to the bytes of y.
+inline uint64_t uleq_step_8(uint64_t x, uint64_t y) {
+  const uint64_t MSBS = 0x8080808080808080UL;
+  return ((((y | MSBS) - (x & ~MSBS)) ^ x ^ y) & MSBS);
+}
+
+// Broadword selection, Vigna, "Broadword implementation of rank/select
+// queries", 2008. The target byte is found by comparing cumulative byte
+// counts and the target bit by doing the same for the bits of the byte.
+inline uint64_t select_in_word_broadword(uint64_t word, uint64_t i) {
+  const uint64_t ONES = 0x0101010101010101UL;
+  uint64_t sums = word - ((word >> 1) & 0x5555555555555555UL);
+  sums = (sums & 0x3333333333333333UL) + ((sums >> 2) & 0x3333333333333333UL);
+  sums = (((sums + (sums >> 4)) & 0x0F0F0F0F0F0F0F0FUL) * ONES);
+  const uint64_t place =
+    (((uleq_step_8(sums, i * ONES) >> 7) * ONES) >> 53) & ~0x7UL;
+  i -= ((sums << 8) >> place) & 0xFF;
+
+  const uint64_t byte = (word >> place) & 0xFF;
+  uint64_t bits = ((byte * ONES) & 0x8040201008040201UL) + 0x7F7F7F7F7F7F7F7FUL;
+  bits = (((bits & 0x8080808080808080UL) >> 7) * ONES);
+  return place + ((((uleq_step_8(bits, i * ONES) >> 7) * ONES) >> 56));
+}
+
+struct SelectInByteTable {
+  uint8_t table[256][8];
+
+  constexpr SelectInByteTable() : table() {
+    for (uint64_t byte = 0; byte < 256; ++byte) {
+      uint64_t count = 0;
+      for (uint64_t bit = 0; bit < 8; ++bit) {
+        if ((byte >> bit) & 1) {
+          table[byte][count++] = bit;
+        }
+      }
+    }
+  }
+};
+
+inline constexpr SelectInByteTable SELECT_IN_BYTE;
+
+inline uint64_t select_in_word_table(uint64_t word, uint64_t i) {
+  for (uint64_t place = 0; ; place += 8) {
+    const uint64_t byte = (word >> place) & 0xFF;
+    const uint64_t n_pops = __builtin_popcountll(byte);
+    if (i < n_pops) {
+      return place + SELECT_IN_BYTE.table[byte][i];
+    }
+    i -= n_pops;
+  }
+}
+
+inline SelectInWord choose_select_in_word() {
+  const char *name = getenv("TRIE_EVAL_SELECT");
+  if (name != nullptr) {
+    if (strcmp(name, "pdep") == 0 && CPU.bmi2) {
+      return SELECT_PDEP;
+    } else if (strcmp(name, "broadword") == 0) {
+      return SELECT_BROADWORD;
+    } else if (strcmp(name, "table") == 0) {
+      return SELECT_TABLE;
+    }
+  }
+  return CPU.fast_bmi2 ? SELECT_PDEP : SELECT_BROADWORD;
+}
+
+inline const SelectInWord SELECT_IN_WORD = choose_select_in_word();
+
+inline const char *select_in_word_name() {
+  switch (SELECT_IN_WORD) {
+    case SELECT_PDEP:
+      return "pdep";
+    case SELECT_BROADWORD:
+      return "broadword";
+    default:
+      return "table";
+  }
+}
+
+inline uint64_t select_in_word(uint64_t word, uint64_t i) {
+  assert(i < (uint64_t)__builtin_popcountll(word));
+  switch (SELECT_IN_WORD) {
+    case SELECT_PDEP:
+      return select_in_word_pdep(word, i);
+    case SELECT_BROADWORD:
+      return select_in_word_broadword(word, i);
+    default:
+      return select_in_word_table(word, i);
+  }
+}
+
+}  // namespace trie_eval
+
+#endif  // SELECT_IN_WORD_HPP
@@ -0,0 +1,153 @@
+#ifndef SYMBOL_TABLE_HPP
+#define SYMBOL_TABLE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// SymbolTable is a static table of up to 255 symbols of 1 to 8 bytes, as in
+// FSST (Boncz, Neumann and Leis, "FSST: Fast random access string
+// compression", 2020). A string is encoded into codes, where code c < 255
+// stands for the c-th symbol and ESCAPE is followed by a literal byte. A
+// symbol is kept in a word with its first byte lowest, so that decoding a
+// code is a load and a shift per byte.
+struct SymbolTable {
+  static const uint8_t ESCAPE = 255;
+
+  Vector<uint64_t> symbols;
+  Vector<uint8_t> lengths;
+
+  SymbolTable() : symbols(), lengths() {}
+  ~SymbolTable() {}
+
+  // Encoder trains a table on strings and encodes them with it.
+  class Encoder {
+   public:
+    Encoder() : symbols_(), codes_(), max_length_(0) {}
+
+    // train() builds the table as FSST does: each round encodes a sample
+    // with the current table, counts the symbols it uses and the
+    // concatenations of consecutive ones, and keeps the 255 with the
+    // largest gains, which are their counts times their lengths.
+    void train(const vector<string_view> &strs) {
+      const uint64_t MAX_SAMPLE_BYTES = 1 << 18;
+      const uint64_t N_ROUNDS = 5;
+      uint64_t n_bytes = 0;
+      for (string_view str : strs) {
+        n_bytes += str.length();
+      }
+      uint64_t step = (n_bytes / MAX_SAMPLE_BYTES) + 1;
+      for (uint64_t round = 0; round < N_ROUNDS; ++round) {
+        unordered_map<string, uint64_t> counts;
+        for (uint64_t i = 0; i < strs.size(); i += step) {
+          string_view str = strs[i];
+          string prev;
+          for (uint64_t j = 0; j < str.length(); ) {
+            string symbol(str.substr(j, max(match(str.substr(j)), 1UL)));
+            ++counts[symbol];
+            if (!prev.empty() && prev.length() + symbol.length() <= 8) {
+              ++counts[prev + symbol];
+            }
+            j += symbol.length();
+            prev = move(symbol);
+          }
+        }
+        vector<pair<uint64_t, string>> candidates;
+        for (auto &[symbol, count] : counts) {
+          candidates.emplace_back(count * symbol.length(), symbol);
+        }
+        sort(candidates.begin(), candidates.end(),
+          [](const auto &lhs, const auto &rhs) {
+            return (lhs.first != rhs.first) ? (lhs.first > rhs.first) :
+              (lhs.second < rhs.second);
+          });
+        candidates.resize(min(candidates.size(), (uint64_t)ESCAPE));
+        symbols_.clear();
+        codes_.clear();
+        max_length_ = 0;
+        for (auto &candidate : candidates) {
+          codes_[candidate.second] = (uint8_t)symbols_.size();
+          max_length_ = max(max_length_, (uint64_t)candidate.second.length());
+          symbols_.push_back(move(candidate.second));
+        }
+      }
+    }
+
+    // encode() appends the codes of str to codes by the longest matches.
+    void encode(string_view str, string &codes) const {
+      for (uint64_t i = 0; i < str.length(); ) {
+        uint64_t length = match(str.substr(i));
+        if (length == 0) {
+          codes.push_back((char)ESCAPE);
+          codes.push_back(str[i]);
+          ++i;
+        } else {
+          codes.push_back((char)codes_.at(string(str.substr(i, length))));
+          i += length;
+        }
+      }
+    }
+
+    // finish() sets table to the trained symbols.
+    void finish(SymbolTable &table) const {
+      table.symbols.clear();
+      table.lengths.clear();
+      for (const string &symbol : symbols_) {
+        uint64_t word = 0;
+        for (uint64_t i = 0; i < symbol.length(); ++i) {
+          word |= (uint64_t)(uint8_t)symbol[i] << (i * 8);
+        }
+        table.symbols.push_back(word);
+        table.lengths.push_back((uint8_t)symbol.length());
+      }
+    }
+
+   private:
+    vector<string> symbols_;
+    unordered_map<string, uint8_t> codes_;
+    uint64_t max_length_;
+
+    // match() returns the length of the longest symbol at the start of str
+    // or 0 if there is none.
+    uint64_t match(string_view str) const {
+      for (uint64_t length = min((uint64_t)str.length(), max_length_);
+        length > 0; --length) {
+        if (codes_.count(string(str.substr(0, length))) != 0) {
+          return length;
+        }
+      }
+      return 0;
+    }
+  };
+
+  bool empty() const {
+    return symbols.empty();
+  }
+  uint64_t size() const {
+    return symbols.size() * sizeof(uint64_t) + lengths.size();
+  }
+
+  void write(Writer &writer) const {
+    symbols.write(writer);
+    lengths.write(writer);
+  }
+  void map(Mapper &mapper) {
+    symbols.map(mapper);
+    lengths.map(mapper);
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // SYMBOL_TABLE_HPP
@@ -0,0 +1,185 @@
+#include "tail-pool.hpp"
+
+#include <algorithm>
+
+#include "patricia.hpp"
+
+namespace trie_eval {
+
+TailPool::TailPool()
+  : bytes(), ends(), offsets(), layout(PLAIN), nested(), table() {}
+
+TailPool::~TailPool() {}
+
+TailPool::TailPool(TailPool &&rhs) = default;
+
+TailPool &TailPool::operator=(TailPool &&rhs) = default;
+
+void TailPool::build(const vector<string_view> &tails, uint64_t flags,
+  uint64_t trie_flags) {
+  if ((trie_flags & TRIE_NESTED_TAILS) && !tails.empty()) {
+    build_nested(tails, trie_flags);
+    return;
+  }
+  if (trie_flags & TRIE_FSST_TAILS) {
+    SymbolTable::Encoder encoder;
+    encoder.train(tails);
+    vector<string> codes(tails.size());
+    vector<string_view> coded_tails(tails.size());
+    for (uint64_t i = 0; i < tails.size(); ++i) {
+      encoder.encode(tails[i], codes[i]);
+      coded_tails[i] = codes[i];
+    }
+    build(coded_tails, flags);
+    encoder.finish(table);
+    return;
+  }
+  build_merged(tails, flags);
+  TailPool plain;
+  plain.build_plain(tails, flags);
+  if (plain.size() <= size()) {
+    *this = move(plain);
+  }
+}
+
+uint64_t TailPool::size() const {
+  uint64_t size = bytes.size() + ends.size() + offsets.size() + table.size();
+  if (nested) {
+    size += nested->size();
+  }
+  return size;
+}
+
+void TailPool::write(Writer &writer) const {
+  bytes.write(writer);
+  ends.write(writer);
+  offsets.write(writer);
+  writer.write((uint64_t)layout);
+  table.write(writer);
+  if (layout == NESTED) {
+    nested->write(writer);
+  }
+}
+
+void TailPool::map(Mapper &mapper) {
+  bytes.map(mapper);
+  ends.map(mapper);
+  offsets.map(mapper);
+  mapper.map(layout);
+  table.map(mapper);
+  nested.reset();
+  if (layout == NESTED) {
+    nested = make_unique<Patricia>();
+    nested->map(mapper);
+  }
+}
+
+void TailPool::build_plain(const vector<string_view> &tails,
+  uint64_t flags) {
+  layout = PLAIN;
+  for (string_view tail : tails) {
+    assert(!tail.empty());
+    for (uint64_t i = 0; i < tail.length(); ++i) {
+      bytes.push_back(tail[i]);
+    }
+    ends.append_run(0, tail.length() - 1);
+    ends.add(1);
+  }
+  ends.build(flags | BitVector::SELECT1);
+}
+
+// The merged ends only need operator[] and next1().
+void TailPool::build_merged(const vector<string_view> &tails,
+  uint64_t flags) {
+  layout = MERGED;
+  vector<uint64_t> order(tails.size());
+  for (uint64_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  // In descending order of reversed strings, a tail comes after the
+  // tails it is a suffix of.
+  sort(order.begin(), order.end(), [&](uint64_t lhs, uint64_t rhs) {
+    return lexicographical_compare(tails[rhs].rbegin(), tails[rhs].rend(),
+      tails[lhs].rbegin(), tails[lhs].rend());
+  });
+  vector<uint64_t> positions(tails.size());
+  string_view prev;
+  uint64_t prev_pos = 0;
+  for (uint64_t tail_id : order) {
+    string_view tail = tails[tail_id];
+    assert(!tail.empty());
+    if (tail.length() <= prev.length() &&
+      prev.substr(prev.length() - tail.length()) == tail) {
+      positions[tail_id] = prev_pos + prev.length() - tail.length();
+    } else {
+      positions[tail_id] = bytes.size();
+      for (uint64_t i = 0; i < tail.length(); ++i) {
+        bytes.push_back(tail[i]);
+      }
+      ends.append_run(0, tail.length() - 1);
+      ends.add(1);
+    }
+    prev = tail;
+    prev_pos = positions[tail_id];
+  }
+  offsets.init(tails.size(), bytes.size());
+  for (uint64_t i = 0; i < positions.size(); ++i) {
+    offsets.set(i, positions[i]);
+  }
+  ends.build(flags);
+}
+
+// The nested trie has one less level of nested tails. Its keys are sorted
+// and unique, and the node of each tail is its terminal node.
+void TailPool::build_nested(const vector<string_view> &tails,
+  uint64_t trie_flags) {
+  layout = NESTED;
+  vector<string> keys(tails.size());
+  for (uint64_t i = 0; i < tails.size(); ++i) {
+    keys[i].assign(tails[i].rbegin(), tails[i].rend());
+  }
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  uint64_t depth = (trie_flags & TRIE_NESTED_TAILS) >> 3;
+  nested = make_unique<Patricia>(
+    (trie_flags & ~TRIE_NESTED_TAILS) | trie_nested_tails(depth - 1));
+  nested->build(keys);
+  vector<uint64_t> node_ids(tails.size());
+  string key;
+  for (uint64_t i = 0; i < tails.size(); ++i) {
+    key.assign(tails[i].rbegin(), tails[i].rend());
+    node_ids[i] = nested->outs_.select1(nested->lookup(key));
+  }
+  offsets.init(tails.size(), nested->n_nodes());
+  for (uint64_t i = 0; i < node_ids.size(); ++i) {
+    offsets.set(i, node_ids[i]);
+  }
+}
+
+int TailPool::compare_nested(uint64_t pos, string_view query,
+  uint64_t &i) const {
+  string tail;
+  nested->restore(pos, tail);
+  for (uint8_t byte : tail) {
+    if (i == query.length() || byte > (uint8_t)query[i]) {
+      return 1;
+    } else if (byte < (uint8_t)query[i]) {
+      return -1;
+    }
+    ++i;
+  }
+  return 0;
+}
+
+// The walk up from a node of a reversed tail restores it in order.
+void TailPool::append_nested(uint64_t pos, string &key) const {
+  nested->restore(pos, key);
+}
+
+void TailPool::append_reverse_nested(uint64_t pos, string &key) const {
+  string tail;
+  nested->restore(pos, tail);
+  key.append(tail.rbegin(), tail.rend());
+}
+
+}  // namespace trie_eval
@@ -0,0 +1,208 @@
+#ifndef TAIL_POOL_HPP
+#define TAIL_POOL_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bit-vector.hpp"
+#include "int-vector.hpp"
+#include "symbol-table.hpp"
+#include "vector.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+class Patricia;
+
+// TailPool keeps the tails of a trie. ends has a 1 at the last byte of
+// each stored tail, and a tail is read from its position up to an end.
+//
+// In the MERGED layout, a tail which is a suffix of another is stored
+// inside its bytes, as marisa-trie does. Tails are sorted by their reversed
+// strings, so that a suffix comes right after a tail it ends, and only
+// tails which are not suffixes of their predecessors are added.
+// offsets[tail_id] is then the position of a tail in bytes. In the PLAIN
+// layout, tails are stored one after another in order of ID, so a tail
+// starts right after the (tail_id - 1)-th end. build() picks the smaller,
+// as offsets cost more than they save on tails which share few suffixes.
+//
+// With TRIE_NESTED_TAILS, the NESTED layout keeps the reversed tails as the
+// keys of a nested Patricia instead, and offsets[tail_id] is the node of a
+// tail in it. The path from the node up to the root spells the tail, so
+// it is restored by a walk up, which trades time for the space of tails
+// which share prefixes as well as suffixes.
+//
+// With TRIE_FSST_TAILS, the PLAIN and MERGED layouts keep the codes of the
+// tails by table instead of their bytes, and the tails are decoded as they
+// are compared or appended.
+struct TailPool {
+  enum Layout : uint64_t {
+    PLAIN,
+    MERGED,
+    NESTED,
+  };
+
+  Vector<uint8_t> bytes;
+  BitVector ends;
+  IntVector offsets;
+  Layout layout;
+  unique_ptr<Patricia> nested;
+  SymbolTable table;
+
+  TailPool();
+  ~TailPool();
+  TailPool(TailPool &&rhs);
+  TailPool &operator=(TailPool &&rhs);
+
+  // build() stores tails, whose IDs are their indexes. flags are for ends
+  // and trie_flags give the depth of nested tails.
+  void build(const vector<string_view> &tails, uint64_t flags = 0,
+    uint64_t trie_flags = 0);
+
+  uint64_t size() const;
+
+  void write(Writer &writer) const;
+  void map(Mapper &mapper);
+
+  uint64_t pos(uint64_t tail_id) const {
+    if (layout != PLAIN) {
+      return offsets[tail_id];
+    }
+    return (tail_id != 0) ? (ends.select1(tail_id - 1) + 1) : 0;
+  }
+  void prefetch(uint64_t tail_id) const {
+    if (layout != PLAIN) {
+      offsets.prefetch(tail_id);
+    } else if (tail_id != 0) {
+      ends.prefetch_select1_sample(tail_id - 1);
+    }
+  }
+  void prefetch_bytes(uint64_t pos) const {
+    if (layout != NESTED) {
+      __builtin_prefetch(bytes.data() + pos);
+      ends.prefetch(pos);
+    }
+  }
+
+  // compare() compares the tail at pos with query from i and moves i past
+  // the bytes which match. It returns 0 if the whole tail matches, 1 if the
+  // tail is greater or the query ends first and -1 if the tail is less.
+  int compare(uint64_t pos, string_view query, uint64_t &i) const {
+    if (layout == NESTED) {
+      return compare_nested(pos, query, i);
+    } else if (!table.empty()) {
+      return compare_codes(pos, query, i);
+    }
+    do {
+      if (i == query.length() || bytes[pos] > (uint8_t)query[i]) {
+        return 1;
+      } else if (bytes[pos] < (uint8_t)query[i]) {
+        return -1;
+      }
+      ++i;
+    } while (!ends[pos++]);
+    return 0;
+  }
+
+  // append() appends the tail at pos to key.
+  void append(uint64_t pos, string &key) const {
+    if (layout == NESTED) {
+      append_nested(pos, key);
+      return;
+    } else if (!table.empty()) {
+      append_codes(pos, key);
+      return;
+    }
+    do {
+      key.push_back(bytes[pos]);
+    } while (!ends[pos++]);
+  }
+  // append_reverse() appends the tail at pos to key in reverse order.
+  void append_reverse(uint64_t pos, string &key) const {
+    if (layout == NESTED) {
+      append_reverse_nested(pos, key);
+      return;
+    } else if (!table.empty()) {
+      // The codes are decoded forward in place and then reversed.
+      uint64_t length = key.length();
+      append_codes(pos, key);
+      reverse(key.begin() + length, key.end());
+      return;
+    }
+    uint64_t end = ends.next1(pos) + 1;
+    do {
+      key.push_back(bytes[--end]);
+    } while (end != pos);
+  }
+
+ private:
+  void build_plain(const vector<string_view> &tails, uint64_t flags);
+  void build_merged(const vector<string_view> &tails, uint64_t flags);
+  void build_nested(const vector<string_view> &tails, uint64_t trie_flags);
+
+  int compare_nested(uint64_t pos, string_view query, uint64_t &i) const;
+
+  // compare_codes() compares a symbol with the query a word at a time while
+  // 8 bytes of the query are left, and then byte by byte.
+  int compare_codes(uint64_t pos, string_view query, uint64_t &i) const {
+    do {
+      uint64_t symbol;
+      uint64_t length;
+      if (bytes[pos] == SymbolTable::ESCAPE) {
+        symbol = bytes[++pos];
+        length = 1;
+      } else {
+        symbol = table.symbols[bytes[pos]];
+        length = table.lengths[bytes[pos]];
+      }
+      uint64_t k = 0;
+      if (query.length() - i >= 8) {
+        uint64_t word;
+        memcpy(&word, query.data() + i, 8);
+        uint64_t diff = word ^ symbol;
+        if (length < 8) {
+          diff &= (1UL << (length * 8)) - 1;
+        }
+        if (diff == 0) {
+          i += length;
+          continue;
+        }
+        k = __builtin_ctzll(diff) / 8;
+        i += k;
+        symbol >>= k * 8;
+      }
+      for ( ; k < length; ++k, symbol >>= 8) {
+        if (i == query.length() || (uint8_t)symbol > (uint8_t)query[i]) {
+          return 1;
+        } else if ((uint8_t)symbol < (uint8_t)query[i]) {
+          return -1;
+        }
+        ++i;
+      }
+    } while (!ends[pos++]);
+    return 0;
+  }
+  void append_codes(uint64_t pos, string &key) const {
+    do {
+      if (bytes[pos] == SymbolTable::ESCAPE) {
+        key.push_back(bytes[++pos]);
+      } else {
+        uint64_t symbol = table.symbols[bytes[pos]];
+        key.append(reinterpret_cast<const char *>(&symbol),
+          table.lengths[bytes[pos]]);
+      }
+    } while (!ends[pos++]);
+  }
+  void append_nested(uint64_t pos, string &key) const;
+  void append_reverse_nested(uint64_t pos, string &key) const;
+};
+
+}  // namespace trie_eval
+
+#endif  // TAIL_POOL_HPP
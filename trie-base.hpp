@@ -1,14 +1,53 @@
 #ifndef TRIE_BASE_HPP
 #define TRIE_BASE_HPP
 
+#include <cassert>
 #include <cstdint>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace trie_eval {
 
 using namespace std;
 
+// Flags given to the constructors of tries.
+enum TrieFlags : uint64_t {
+  // BitVectors use the interleaved layout (see BitVector::Line).
+  TRIE_INTERLEAVED = 1 << 0,
+  // Trie adds dense bitmaps of the children of its top levels (see
+  // Trie::dense_). The other tries ignore it.
+  TRIE_DENSE = 1 << 1,
+  // The bits of terminal and linked nodes use CompressedBitVector, which
+  // picks Elias-Fano or RRR for each by density if it is smaller.
+  TRIE_COMPRESSED = 1 << 2,
+  // Patricia and Indirect keep their tails reversed as the keys of a nested
+  // Patricia, whose tails are nested in turn, as deep as these bits say
+  // (see trie_nested_tails()). The other tries ignore them.
+  TRIE_NESTED_TAILS = 3 << 3,
+  // Patricia and Indirect encode their tails with a symbol table trained on
+  // them (see SymbolTable). With TRIE_NESTED_TAILS, the innermost tails are
+  // encoded.
+  TRIE_FSST_TAILS = 1 << 5,
+  // FrontCoding puts 2^(these bits) keys in a bucket, or 16 if they are 0
+  // (see trie_bucket_size()). The other tries ignore them.
+  TRIE_BUCKET_SIZE = 15 << 6,
+};
+
+// trie_nested_tails() returns the flags for depth levels of nested tails.
+constexpr uint64_t trie_nested_tails(uint64_t depth) {
+  assert(depth <= 3);
+  return depth << 3;
+}
+
+// trie_bucket_size() returns the flags for buckets of size keys, which must
+// be a power of 2 from 2 to 2^15.
+constexpr uint64_t trie_bucket_size(uint64_t size) {
+  assert(size >= 2 && size <= (1 << 15) && (size & (size - 1)) == 0);
+  return (uint64_t)__builtin_ctzll(size) << 6;
+}
+
 class TrieBase {
  public:
   TrieBase() {}
@@ -21,6 +60,32 @@ class TrieBase {
 
   virtual uint64_t lookup(const string &query) const = 0;
   virtual void reverse_lookup(uint64_t id, string &key) const = 0;
+
+  // lookup_batch() and reverse_lookup_batch() are lookup() and
+  // reverse_lookup() for many queries at once. Engines override them to
+  // overlap the memory accesses of different queries.
+  virtual void lookup_batch(span<const string_view> queries,
+    span<uint64_t> ids) const {
+    assert(queries.size() == ids.size());
+    string query;
+    for (uint64_t i = 0; i < queries.size(); ++i) {
+      query.assign(queries[i]);
+      ids[i] = lookup(query);
+    }
+  }
+  virtual void reverse_lookup_batch(span<const uint64_t> ids,
+    span<string> keys) const {
+    assert(ids.size() == keys.size());
+    for (uint64_t i = 0; i < ids.size(); ++i) {
+      reverse_lookup(ids[i], keys[i]);
+    }
+  }
+
+  // save() writes the trie to a file and map() maps such a file instead of
+  // building the trie. A mapped trie refers to the file until it is
+  // destroyed or mapped again. Both return false on failure.
+  virtual bool save(const char *path) const = 0;
+  virtual bool map(const char *path) = 0;
 };
 
 }  // namespace trie_eval
@@ -1,11 +1,38 @@
 #include "trie.hpp"
 
 #include <algorithm>
+#include <memory>
+
+#include "batch.hpp"
+#include "find-label.hpp"
+#include "parallel.hpp"
 
 namespace trie_eval {
+namespace {
+
+struct LookupState {
+  string_view query;
+  uint64_t *id;
+  uint64_t i;
+  uint64_t node_id;
+  uint64_t pos;
+  bool done;
+};
+
+struct ReverseLookupState {
+  string *key;
+  uint64_t level_id;
+  uint64_t node_id;
+  // The key id in outs has not been converted to a node yet.
+  bool outs;
+  bool done;
+};
+
+}  // namespace
 
-Trie::Trie()
-  : levels_(2), n_keys_(0), n_nodes_(1), size_(0), last_key_() {
+Trie::Trie(uint64_t flags)
+  : levels_(2), dense_(), n_keys_(0), n_nodes_(1), size_(0), flags_(flags),
+    last_key_(), mapper_() {
   levels_[0].louds.add(0);
   levels_[0].louds.add(1);
   levels_[1].louds.add(1);
@@ -14,26 +41,99 @@ Trie::Trie()
 }
 
 void Trie::build(const vector<string> &keys) {
+  Builder builder(*this);
   for (auto it = keys.begin(); it != keys.end(); ++it) {
-    add(*it);
+    builder.add(*it);
+  }
+  builder.finish();
+}
+
+// The levels of the parts are concatenated, except that the children of
+// the roots are merged into one group.
+void Trie::build(const vector<string> &keys, uint64_t n_threads) {
+  vector<uint64_t> bounds = split_keys(keys, n_threads);
+  vector<unique_ptr<Trie>> parts(bounds.size() - 1);
+  parallel(n_threads, parts.size(), [&](uint64_t part_id) {
+    parts[part_id].reset(new Trie(flags_));
+    for (uint64_t i = bounds[part_id]; i < bounds[part_id + 1]; ++i) {
+      parts[part_id]->add(keys[i]);
+    }
+  });
+
+  uint64_t n_levels = 0;
+  for (uint64_t i = 0; i < parts.size(); ++i) {
+    n_levels = max(n_levels, (uint64_t)parts[i]->levels_.size());
+    n_keys_ += parts[i]->n_keys_;
+    n_nodes_ += parts[i]->n_nodes_ - 1;
+  }
+  levels_[0].outs.set(0, parts[0]->levels_[0].outs[0]);
+  levels_.resize(1);
+  levels_.resize(n_levels);
+  parallel(n_threads, n_levels - 1, [&](uint64_t level_id) {
+    Level &level = levels_[level_id + 1];
+    for (uint64_t i = 0; i < parts.size(); ++i) {
+      if (level_id + 1 >= parts[i]->levels_.size()) {
+        continue;
+      }
+      const Level &part = parts[i]->levels_[level_id + 1];
+      level.louds.append(part.louds,
+        part.louds.n_bits - (uint64_t)(level_id == 0));
+      level.outs.append(part.outs, part.outs.n_bits);
+      for (uint64_t j = 0; j < part.labels.size(); ++j) {
+        level.labels.push_back(part.labels[j]);
+      }
+      level.offset += part.offset;
+    }
+    if (level_id == 0) {
+      level.louds.add(1);
+    }
+  });
+  last_key_ = parts.back()->last_key_;
+  finish(n_threads);
+}
+
+void Trie::Builder::finish() {
+  trie_.finish(1);
+}
+
+void Trie::finish(uint64_t n_threads) {
+  uint64_t bv_flags = 0;
+  if (flags_ & TRIE_INTERLEAVED) {
+    bv_flags |= BitVector::INTERLEAVED;
+  }
+  uint64_t outs_flags = bv_flags;
+  if (flags_ & TRIE_COMPRESSED) {
+    outs_flags |= BitVector::COMPRESSED;
   }
   uint64_t offset = 0;
   for (uint64_t i = 0; i < levels_.size(); ++i) {
     Level &level = levels_[i];
-    level.louds.build();
-    level.outs.build();
-    offset += levels_[i].offset;
+    level.louds.build(bv_flags | BitVector::SELECT0 | BitVector::SELECT1,
+      n_threads);
+    level.outs.build(outs_flags | BitVector::SELECT1, n_threads);
+    offset += level.offset;
     level.offset = offset;
     size_ += level.size();
   }
+  if (flags_ & TRIE_DENSE) {
+    build_dense(bv_flags, n_threads);
+  }
 }
 
 uint64_t Trie::lookup(const string &query) const {
   if (query.length() >= levels_.size()) {
-    return false;
+    return -1;
   }
   uint64_t node_id = 0;
-  for (uint64_t i = 0; i < query.length(); ++i) {
+  uint64_t i = 0;
+  for ( ; i < min((uint64_t)query.length(), (uint64_t)dense_.size()); ++i) {
+    uint64_t pos = (node_id * 256) + (uint8_t)query[i];
+    if (!dense_[i][pos]) {
+      return -1;
+    }
+    node_id = dense_[i].rank1(pos);
+  }
+  for ( ; i < query.length(); ++i) {
     const Level &level = levels_[i + 1];
     uint64_t node_pos;
     if (node_id != 0) {
@@ -52,32 +152,12 @@ uint64_t Trie::lookup(const string &query) const {
     //   }
     // }
 
-    uint64_t end = node_pos;
-    uint64_t word = level.louds.words[end / 64] >> (end % 64);
-    if (word == 0) {
-      end += 64 - (end % 64);
-      word = level.louds.words[end / 64];
-      while (word == 0) {
-        end += 64;
-        word = level.louds.words[end / 64];
-      }
-    }
-    end += __builtin_ctzll(word);
+    uint64_t end = level.louds.next1(node_pos);
     uint64_t begin = node_id;
     end = begin + end - node_pos;
 
-    uint8_t byte = query[i];
-    while (begin < end) {
-      node_id = (begin + end) / 2;
-      if (byte < level.labels[node_id]) {
-        end = node_id;
-      } else if (byte > level.labels[node_id]) {
-        begin = node_id + 1;
-      } else {
-        break;
-      }
-    }
-    if (begin >= end) {
+    node_id = find_label(level.labels, begin, end, query[i]);
+    if (node_id == end) {
       return -1;
     }
   }
@@ -110,7 +190,289 @@ void Trie::reverse_lookup(uint64_t id, string &key) const {
   reverse(key.begin(), key.end());
 }
 
-void Trie::add(const string &key) {
+void Trie::lookup_batch(span<const string_view> queries,
+  span<uint64_t> ids) const {
+  assert(queries.size() == ids.size());
+  interleave<LookupState>(queries.size(),
+    [&](LookupState &state, uint64_t i) {
+      state.query = queries[i];
+      state.id = &ids[i];
+      state.i = 0;
+      state.node_id = 0;
+      if (state.query.length() >= levels_.size()) {
+        *state.id = -1;
+        return false;
+      } else if (state.query.empty()) {
+        const Level &level = levels_[0];
+        *state.id = level.outs[0] ? level.offset + level.outs.rank1(0) : -1;
+        return false;
+      }
+      return true;
+    },
+    // A round moves each state down by one level.
+    [&](LookupState *states, uint64_t n_states) {
+      for (uint64_t j = 0; j < n_states; ++j) {
+        const LookupState &state = states[j];
+        if (state.node_id != 0) {
+          const Level &level = levels_[state.i + 1];
+          level.louds.prefetch_select1_sample(state.node_id - 1);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        const LookupState &state = states[j];
+        if (state.node_id != 0) {
+          const Level &level = levels_[state.i + 1];
+          level.louds.prefetch_select1_block(state.node_id - 1);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        const Level &level = levels_[state.i + 1];
+        if (state.node_id != 0) {
+          state.pos = level.louds.select1(state.node_id - 1) + 1;
+          state.node_id = state.pos - state.node_id;
+        } else {
+          state.pos = 0;
+        }
+        level.louds.prefetch(state.pos);
+        __builtin_prefetch(level.labels.data() + state.node_id);
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        const Level &level = levels_[state.i + 1];
+        uint64_t end = level.louds.next1(state.pos);
+        uint64_t begin = state.node_id;
+        end = begin + end - state.pos;
+
+        state.node_id = find_label(level.labels, begin, end,
+          state.query[state.i]);
+        if (state.node_id == end) {
+          *state.id = -1;
+          state.done = true;
+        } else if (++state.i == state.query.length()) {
+          levels_[state.i].outs.prefetch_rank(state.node_id);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        LookupState &state = states[j];
+        if (!state.done && state.i == state.query.length()) {
+          const Level &level = levels_[state.i];
+          *state.id = level.outs[state.node_id] ?
+            level.offset + level.outs.rank1(state.node_id) : -1;
+          state.done = true;
+        }
+      }
+    });
+}
+
+void Trie::reverse_lookup_batch(span<const uint64_t> ids,
+  span<string> keys) const {
+  assert(ids.size() == keys.size());
+  interleave<ReverseLookupState>(ids.size(),
+    [&](ReverseLookupState &state, uint64_t i) {
+      uint64_t id = ids[i];
+      assert(id < n_keys());
+      state.key = &keys[i];
+      state.key->clear();
+      state.level_id = 0;
+      while (id >= levels_[state.level_id + 1].offset) {
+        ++state.level_id;
+      }
+      if (state.level_id == 0) {
+        return false;
+      }
+      state.node_id = id - levels_[state.level_id].offset;
+      state.outs = true;
+      levels_[state.level_id].outs.prefetch_select1_sample(state.node_id);
+      return true;
+    },
+    // A round moves each state up by one level.
+    [&](ReverseLookupState *states, uint64_t n_states) {
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        if (!state.outs) {
+          const Level &level = levels_[state.level_id];
+          state.key->push_back(level.labels[state.node_id]);
+          if (state.level_id == 1) {
+            reverse(state.key->begin(), state.key->end());
+            state.done = true;
+          } else {
+            level.louds.prefetch_select0_block(state.node_id);
+          }
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        if (!state.outs && !state.done) {
+          uint64_t node_pos =
+            levels_[state.level_id].louds.select0(state.node_id);
+          state.node_id = node_pos - state.node_id;
+          const Level &level = levels_[--state.level_id];
+          __builtin_prefetch(level.labels.data() + state.node_id);
+          level.louds.prefetch_select0_sample(state.node_id);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        const ReverseLookupState &state = states[j];
+        if (state.outs) {
+          levels_[state.level_id].outs.prefetch_select1_block(state.node_id);
+        }
+      }
+      for (uint64_t j = 0; j < n_states; ++j) {
+        ReverseLookupState &state = states[j];
+        if (state.outs) {
+          const Level &level = levels_[state.level_id];
+          state.node_id = level.outs.select1(state.node_id);
+          __builtin_prefetch(level.labels.data() + state.node_id);
+          level.louds.prefetch_select0_sample(state.node_id);
+          state.outs = false;
+        }
+      }
+    });
+}
+
+bool Trie::Cursor::next() {
+  while (!stack_.empty()) {
+    Frame &frame = stack_.back();
+    if (frame.node_id == frame.end) {
+      stack_.pop_back();
+      continue;
+    }
+    uint64_t level_id = frame.level_id;
+    uint64_t node_id = frame.node_id++;
+    const Level &level = trie_->levels_[level_id];
+    if (level_id != 0) {
+      key_.resize(level_id - 1);
+      key_.push_back(level.labels[node_id]);
+    }
+    if (level_id + 1 < trie_->levels_.size()) {
+      uint64_t begin, end;
+      trie_->children(level_id, node_id, begin, end);
+      if (begin < end) {
+        stack_.push_back(Frame{ level_id + 1, begin, end });
+      }
+    }
+    if (level.outs[node_id]) {
+      id_ = level.offset + level.outs.rank1(node_id);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Trie::predictive_search(string_view prefix, Cursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.stack_.clear();
+  cursor.key_.clear();
+  cursor.id_ = -1;
+  if (prefix.length() >= levels_.size()) {
+    return;
+  }
+  uint64_t node_id = 0;
+  for (uint64_t i = 0; i < prefix.length(); ++i) {
+    node_id = find_child(i, node_id, prefix[i]);
+    if (node_id == (uint64_t)-1) {
+      return;
+    }
+  }
+  if (!prefix.empty()) {
+    cursor.key_.assign(prefix.substr(0, prefix.length() - 1));
+  }
+  cursor.stack_.push_back(
+    Cursor::Frame{ prefix.length(), node_id, node_id + 1 });
+}
+
+bool Trie::PrefixCursor::next() {
+  while (node_id_ != (uint64_t)-1) {
+    uint64_t node_id = node_id_;
+    length_ = pos_;
+    // Move on to the child which matches the query, if any.
+    node_id_ = -1;
+    if (pos_ < query_.length() && pos_ + 1 < trie_->levels_.size()) {
+      node_id_ = trie_->find_child(pos_, node_id, query_[pos_]);
+      ++pos_;
+    }
+    const Level &level = trie_->levels_[length_];
+    if (level.outs[node_id]) {
+      id_ = level.offset + level.outs.rank1(node_id);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Trie::common_prefix_search(string_view query,
+  PrefixCursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.query_ = query;
+  cursor.node_id_ = 0;
+  cursor.pos_ = 0;
+  cursor.length_ = 0;
+  cursor.id_ = -1;
+}
+
+bool Trie::save(const char *path) const {
+  Writer writer;
+  if (!writer.open(path)) {
+    return false;
+  }
+  writer.write_header(name());
+  writer.write((uint64_t)levels_.size());
+  for (uint64_t i = 0; i < levels_.size(); ++i) {
+    levels_[i].write(writer);
+  }
+  writer.write((uint64_t)dense_.size());
+  for (uint64_t i = 0; i < dense_.size(); ++i) {
+    dense_[i].write(writer);
+  }
+  writer.write(n_keys_);
+  writer.write(n_nodes_);
+  writer.write(size_);
+  writer.write(flags_);
+  return writer.close();
+}
+
+bool Trie::map(const char *path) {
+  Mapper mapper;
+  if (!mapper.open(path) || !mapper.map_header(name())) {
+    return false;
+  }
+  // The file is mapped into a new trie, so that this one is kept if the
+  // file is broken.
+  Trie trie;
+  // Each level takes at least 8 bytes, and the bitmaps are only for the
+  // levels there are.
+  uint64_t n_levels = 0;
+  mapper.map(n_levels);
+  if (!mapper.check(n_levels <= mapper.remaining() / 8)) {
+    return false;
+  }
+  trie.levels_.resize(n_levels);
+  for (uint64_t i = 0; i < trie.levels_.size(); ++i) {
+    trie.levels_[i].map(mapper);
+  }
+  uint64_t n_dense_levels = 0;
+  mapper.map(n_dense_levels);
+  if (!mapper.check(n_dense_levels <= n_levels)) {
+    return false;
+  }
+  trie.dense_.resize(n_dense_levels);
+  for (uint64_t i = 0; i < trie.dense_.size(); ++i) {
+    trie.dense_[i].map(mapper);
+  }
+  mapper.map(trie.n_keys_);
+  mapper.map(trie.n_nodes_);
+  mapper.map(trie.size_);
+  mapper.map(trie.flags_);
+  if (!mapper.ok()) {
+    return false;
+  }
+  trie.mapper_ = move(mapper);
+  *this = move(trie);
+  return true;
+}
+
+void Trie::add(string_view key) {
   assert(key > last_key_);
   if (key.empty()) {
     levels_[0].outs.set(0, 1);
@@ -136,8 +498,8 @@ void Trie::add(const string &key) {
   }
   for (++i; i < key.length(); ++i) {
     Level &level = levels_[i + 1];
-    level.louds.add(0);
-    level.louds.add(1);
+    // A node with one child adds "01" to the LOUDS of the next level.
+    level.louds.append_bits(2, 2);
     level.outs.add(0);
     level.labels.push_back(key[i]);
     ++n_nodes_;
@@ -149,4 +511,65 @@ void Trie::add(const string &key) {
   last_key_ = key;
 }
 
+// build_dense() adds bitmaps for the top levels while they fit in the
+// budget. The children of a level are read from the LOUDS bits of the next
+// level, in which a node has a 0 per child and then a 1.
+void Trie::build_dense(uint64_t bv_flags, uint64_t n_threads) {
+  uint64_t budget = size_ / DENSE_RATIO;
+  for (uint64_t level_id = 0; level_id + 1 < levels_.size(); ++level_id) {
+    const Level &level = levels_[level_id + 1];
+    // The bits and their ranks are a lower bound of the size, which is
+    // checked before the bitmap is allocated, as the first level over the
+    // budget can be far larger than the trie.
+    uint64_t n_bits = levels_[level_id].outs.n_bits * 256;
+    if ((n_bits / 8) + ((n_bits / 256) * sizeof(BitVector::Rank)) > budget) {
+      break;
+    }
+    BitVector dense;
+    dense.resize(n_bits);
+    uint64_t node_id = 0;
+    uint64_t child_id = 0;
+    for (uint64_t i = 0; i < level.louds.n_bits; ++i) {
+      if (level.louds[i]) {
+        ++node_id;
+      } else {
+        dense.set((node_id * 256) + level.labels[child_id++], 1);
+      }
+    }
+    // The bitmaps only need rank1().
+    dense.build(bv_flags, n_threads);
+    if (dense.size() > budget) {
+      break;
+    }
+    budget -= dense.size();
+    size_ += dense.size();
+    dense_.push_back(move(dense));
+  }
+}
+
+void Trie::children(uint64_t level_id, uint64_t node_id, uint64_t &begin,
+  uint64_t &end) const {
+  const Level &level = levels_[level_id + 1];
+  uint64_t node_pos = 0;
+  if (node_id != 0) {
+    node_pos = level.louds.select1(node_id - 1) + 1;
+  }
+  end = level.louds.next1(node_pos);
+  begin = node_pos - node_id;
+  end = begin + end - node_pos;
+}
+
+uint64_t Trie::find_child(uint64_t level_id, uint64_t node_id,
+  uint8_t byte) const {
+  if (level_id < dense_.size()) {
+    uint64_t pos = (node_id * 256) + byte;
+    return dense_[level_id][pos] ? dense_[level_id].rank1(pos) : -1;
+  }
+  const Level &level = levels_[level_id + 1];
+  uint64_t begin, end;
+  children(level_id, node_id, begin, end);
+  uint64_t child_id = find_label(level.labels, begin, end, byte);
+  return (child_id != end) ? child_id : -1;
+}
+
 }  // namespace trie_eval
@@ -2,6 +2,7 @@
 #define TRIE_HPP
 
 #include "bit-vector.hpp"
+#include "compressed-bit-vector.hpp"
 #include "trie-base.hpp"
 
 namespace trie_eval {
@@ -10,14 +11,116 @@ using namespace std;
 
 class Trie : TrieBase {
  public:
-  Trie();
+  explicit Trie(uint64_t flags = 0);
   ~Trie() {}
 
+  Trie(Trie &&) = default;
+  Trie &operator=(Trie &&) = default;
+
+  // Builder builds a trie from keys given one at a time in sorted order, so
+  // that they need not be in memory at once. The levels are built as keys
+  // come, so it adds them to the trie directly.
+  class Builder {
+   public:
+    explicit Builder(Trie &trie) : trie_(trie) {}
+
+    void add(string_view key) {
+      trie_.add(key);
+    }
+    void finish();
+
+   private:
+    Trie &trie_;
+  };
+
   void build(const vector<string> &keys);
+  // build() with n_threads splits keys by their first bytes and builds the
+  // parts on up to n_threads threads. The trie is the same as with one.
+  void build(const vector<string> &keys, uint64_t n_threads);
 
   uint64_t lookup(const string &query) const;
   void reverse_lookup(uint64_t id, string &key) const;
 
+  void lookup_batch(span<const string_view> queries,
+    span<uint64_t> ids) const;
+  void reverse_lookup_batch(span<const uint64_t> ids,
+    span<string> keys) const;
+
+  // Cursor enumerates keys in lexicographic order. key() is a buffer which
+  // is reused by next(), so no string is allocated per key.
+  class Cursor {
+   public:
+    Cursor() : trie_(nullptr), stack_(), key_(), id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    const string &key() const {
+      return key_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class Trie;
+
+    // Frame is a range of siblings which are not visited yet. The key of a
+    // node at level_id has level_id bytes.
+    struct Frame {
+      uint64_t level_id;
+      uint64_t node_id;
+      uint64_t end;
+    };
+
+    const Trie *trie_;
+    vector<Frame> stack_;
+    string key_;
+    uint64_t id_;
+  };
+
+  // predictive_search() sets cursor to the keys which start with prefix.
+  void predictive_search(string_view prefix, Cursor &cursor) const;
+
+  // PrefixCursor enumerates the keys which are prefixes of a query in order
+  // of length.
+  class PrefixCursor {
+   public:
+    PrefixCursor()
+      : trie_(nullptr), query_(), node_id_(-1), pos_(0), length_(0),
+        id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    // The key is the first length() bytes of the query.
+    uint64_t length() const {
+      return length_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class Trie;
+
+    const Trie *trie_;
+    string_view query_;
+    // node_id_ is the next node to visit. It is at level pos_ and the first
+    // pos_ bytes of the query are its key.
+    uint64_t node_id_;
+    uint64_t pos_;
+    uint64_t length_;
+    uint64_t id_;
+  };
+
+  // common_prefix_search() sets cursor to the keys which are prefixes of
+  // query.
+  void common_prefix_search(string_view query, PrefixCursor &cursor) const;
+
+  bool save(const char *path) const;
+  bool map(const char *path);
+
   const char *name() const {
     return "LOUDS trie";
   }
@@ -30,12 +133,15 @@ class Trie : TrieBase {
   uint64_t size() const {
     return size_;
   }
+  uint64_t flags() const {
+    return flags_;
+  }
 
  private:
   struct Level {
     BitVector louds;
-    BitVector outs;
-    vector<uint8_t> labels;
+    CompressedBitVector outs;
+    Vector<uint8_t> labels;
     uint64_t offset;
 
     Level() : louds(), outs(), labels(), offset(0) {}
@@ -43,15 +149,50 @@ class Trie : TrieBase {
     uint64_t size() const {
       return louds.size() + outs.size() + labels.size();
     }
+
+    void write(Writer &writer) const {
+      louds.write(writer);
+      outs.write(writer);
+      labels.write(writer);
+      writer.write(offset);
+    }
+    void map(Mapper &mapper) {
+      louds.map(mapper);
+      outs.map(mapper);
+      labels.map(mapper);
+      mapper.map(offset);
+    }
   };
 
   vector<Level> levels_;
+  // dense_[level_id] has 256 bits per node at level_id, which are 1 for
+  // the labels of its children. The child labeled byte is then found by
+  // rank1(node_id * 256 + byte) without select1() or a label search. Only
+  // the top levels, which are small and hot, get a bitmap, and the sparse
+  // levels are kept for the other operations.
+  vector<BitVector> dense_;
   uint64_t n_keys_;
   uint64_t n_nodes_;
   uint64_t size_;
+  uint64_t flags_;
   string last_key_;
+  Mapper mapper_;
+
+  // The bitmaps of TRIE_DENSE take up to 1/DENSE_RATIO of the size of the
+  // levels.
+  static const uint64_t DENSE_RATIO = 8;
 
-  void add(const string &key);
+  void add(string_view key);
+  // finish() builds the indexes of the levels on up to n_threads threads.
+  void finish(uint64_t n_threads);
+  void build_dense(uint64_t bv_flags, uint64_t n_threads);
+  // children() sets [begin, end) to the IDs of the children of node_id at
+  // level_id + 1.
+  void children(uint64_t level_id, uint64_t node_id, uint64_t &begin,
+    uint64_t &end) const;
+  // find_child() returns the ID of the child of node_id labeled byte or -1.
+  uint64_t find_child(uint64_t level_id, uint64_t node_id,
+    uint8_t byte) const;
 };
 
 }  // namespace trie_eval
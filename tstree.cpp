@@ -1,177 +1,317 @@
 #include "tstree.hpp"
 
 #include <algorithm>
-#include <queue>
+
+#include "parallel.hpp"
 
 namespace trie_eval {
 namespace {
 
-struct Trie {
-  struct Level {
-    BitVector louds;
-    BitVector outs;
-    vector<uint8_t> labels;
-    uint64_t offset;
-
-    Level() : louds(), outs(), labels(), offset(0) {}
+// Level has the ends of the nodes and the tail bytes of a level of the
+// tree, which are filled back to front.
+struct Level {
+  uint64_t node_id;
+  uint64_t tail_pos;
+};
 
-    uint64_t size() const {
-        return louds.size() + outs.size() + labels.size();
+// split() returns the depth of the sibling_id-th sibling in the tree of
+// n_siblings siblings, where the middle of a range is the root of the
+// lower and higher halves. lo and hi tell if it has these children.
+uint64_t split(uint64_t sibling_id, uint64_t n_siblings, bool &lo, bool &hi) {
+  uint64_t begin = 0;
+  uint64_t end = n_siblings;
+  uint64_t depth = 0;
+  for ( ; ; ++depth) {
+    uint64_t middle = (begin + end) / 2;
+    if (sibling_id < middle) {
+      end = middle;
+    } else if (sibling_id > middle) {
+      begin = middle + 1;
+    } else {
+      lo = begin < middle;
+      hi = middle + 1 < end;
+      return depth;
     }
-  };
-
-  vector<Level> levels;
-  string last_key;
-  uint64_t n_keys;
-  uint64_t n_nodes;
-
-  Trie() : levels(2), last_key(), n_keys(0), n_nodes(1) {
-    levels[0].louds.add(0);
-    levels[0].louds.add(1);
-    levels[1].louds.add(1);
-    levels[0].outs.add(0);
-    levels[0].labels.push_back(' ');
   }
+}
 
-  void add(const std::string &key) {
-    assert(n_keys == 0 || key > last_key);
-    if (key.empty()) {
-      levels[0].outs.set(0, 1);
-      ++n_keys;
-      return;
-    }
-    if (key.length() + 1 >= levels.size()) {
-      levels.resize(key.length() + 2);
-    }
-    uint64_t i = 0;
-    for ( ; i < key.length(); ++i) {
-      uint8_t byte = key[i];
-      if ((i == last_key.length()) ||
-          (byte != levels[i + 1].labels.back())) {
-        levels[i + 1].louds.set(levels[i + 1].louds.n_bits - 1, 0);
-        levels[i + 1].louds.add(1);
-        levels[i + 1].outs.add(0);
-        levels[i + 1].labels.push_back(key[i]);
-        ++n_nodes;
-        break;
-      }
-    }
-    for (++i; i < key.length(); ++i) {
-      levels[i + 1].louds.add(0);
-      levels[i + 1].louds.add(1);
-      levels[i + 1].outs.add(0);
-      levels[i + 1].labels.push_back(key[i]);
-      ++n_nodes;
-    }
-    levels[i + 1].louds.add(1);
-    levels[i].outs.set(levels[i].outs.n_bits - 1, 1);
-    last_key = key;
-    ++n_keys;
-  }
+// Shape is where a sibling goes in the tree of its siblings, as split()
+// gives it.
+struct Shape {
+  uint8_t depth;
+  bool lo;
+  bool hi;
+};
 
-  void build() {
-    for (uint64_t i = 0; i < levels.size(); ++i) {
-      levels[i].louds.build();
-    }
+// weighted_split() is split() for the siblings in [begin, end) at once,
+// where the root of a range is the sibling which best balances the weights
+// of the lower and higher halves, and ties go to the middle. prefix_sums[i]
+// is the weight of the first i siblings.
+void weighted_split(const vector<uint64_t> &prefix_sums, uint64_t begin,
+  uint64_t end, uint64_t depth, Shape *shapes) {
+  if (begin == end) {
+    return;
   }
-
-  uint64_t size() const {
-    uint64_t size = 0;
-    for (uint64_t i = 0; i < levels.size(); ++i) {
-      const Level &level = levels[i];
-      size += level.louds.size();
-      size += level.outs.size();
-      size += level.labels.size();
+  uint64_t middle = (begin + end) / 2;
+  uint64_t root = middle;
+  uint64_t min_cost = -1;
+  for (uint64_t i = begin; i < end; ++i) {
+    uint64_t cost = max(prefix_sums[i] - prefix_sums[begin],
+      prefix_sums[end] - prefix_sums[i + 1]);
+    uint64_t distance = (i < middle) ? (middle - i) : (i - middle);
+    uint64_t root_distance =
+      (root < middle) ? (middle - root) : (root - middle);
+    if (cost < min_cost || (cost == min_cost && distance < root_distance)) {
+      root = i;
+      min_cost = cost;
     }
-    return size;
   }
-};
+  shapes[root] = Shape{ (uint8_t)depth, begin < root, root + 1 < end };
+  weighted_split(prefix_sums, begin, root, depth + 1, shapes);
+  weighted_split(prefix_sums, root + 1, end, depth + 1, shapes);
+}
 
-struct Node {
-  uint64_t level_id:24;
-  uint64_t begin:40;
-  uint64_t end;
+// Sibling is a node of a part, which is the node_index-th read from it.
+struct Sibling {
+  uint64_t part_id;
+  uint64_t node_index;
+  uint64_t weight;
 };
 
+// shape_siblings() sets shapes[part_id][node_index] by weighted_split().
+// The siblings of a node are read apart, between the subtrees of others,
+// so they are gathered until the first sibling is read. The children of
+// the root are numbered across the parts and split last.
+void shape_siblings(span<const Postorder> parts,
+  const vector<uint64_t> &sibling_bases, uint64_t n_root_children,
+  uint64_t n_threads, vector<vector<Shape>> &shapes) {
+  auto shape = [&shapes](const vector<Sibling> &siblings) {
+    vector<uint64_t> prefix_sums(siblings.size() + 1, 0);
+    for (uint64_t i = 0; i < siblings.size(); ++i) {
+      prefix_sums[i + 1] = prefix_sums[i] + siblings[i].weight;
+    }
+    vector<Shape> sibling_shapes(siblings.size());
+    weighted_split(prefix_sums, 0, siblings.size(), 0, sibling_shapes.data());
+    for (uint64_t i = 0; i < siblings.size(); ++i) {
+      shapes[siblings[i].part_id][siblings[i].node_index] = sibling_shapes[i];
+    }
+  };
+  vector<Sibling> root_children(n_root_children);
+  parallel(n_threads, parts.size(), [&](uint64_t part_id) {
+    shapes[part_id].resize(parts[part_id].n_nodes());
+    // groups[depth] has the siblings being read at depth.
+    vector<vector<Sibling>> groups;
+    Postorder::Node node;
+    Postorder::Reader reader(parts[part_id]);
+    for (uint64_t i = 0; reader.next(node); ++i) {
+      Sibling sibling = { part_id, i, node.weight };
+      if (node.depth == 1) {
+        root_children[sibling_bases[part_id] + node.sibling_id] = sibling;
+      } else if (node.depth != 0) {
+        if (node.depth >= groups.size()) {
+          groups.resize(node.depth + 1);
+        }
+        vector<Sibling> &group = groups[node.depth];
+        if (node.sibling_id + 1 == node.n_siblings) {
+          group.resize(node.n_siblings);
+        }
+        group[node.sibling_id] = sibling;
+        if (node.sibling_id == 0) {
+          shape(group);
+        }
+      }
+    }
+  });
+  shape(root_children);
+}
+
 }  // namespace
 
-TSTree::TSTree()
+TSTree::TSTree(uint64_t flags)
   : tree_(), outs_(), links_(), labels_(), tail_bits_(), tail_bytes_(),
-    n_keys_(0), n_nodes_(0), size_(0) {}
+    n_keys_(0), n_nodes_(0), size_(0), flags_(flags), mapper_() {}
 
 void TSTree::build(const vector<string> &keys) {
-  Trie trie;
+  Builder builder(*this);
   for (auto it = keys.begin(); it != keys.end(); ++it) {
-    trie.add(*it);
+    builder.add(*it);
   }
-  trie.build();
+  builder.finish();
+}
 
-  tree_.add(0);
-  tree_.add(0);
-  tree_.add(0);
-  outs_.add(trie.levels[0].outs[0]);
-  links_.add(0);
-  labels_.push_back(' ');
+void TSTree::Builder::finish() {
+  postorder_.finish();
+  trie_.build(span<const Postorder>(&postorder_, 1), 1);
+}
 
-  queue<Node> queue;
-  if (!trie.levels[1].louds[0]) {
-    tree_.set(1, 1);
-    queue.push(Node{ 1, 0, trie.levels[1].louds.select1(0) });
-  }
-  while (!queue.empty()) {
-    Node node = queue.front();
-    uint64_t middle = (node.end + node.begin) / 2;
-    if (node.begin < middle) {
-      tree_.add(1);
-      queue.push(Node{ node.level_id, node.begin, middle });
-    } else {
-      tree_.add(0);
+void TSTree::build(const vector<string> &keys, uint64_t n_threads) {
+  build(keys, span<const uint64_t>(), n_threads);
+}
+
+void TSTree::build(const vector<string> &keys, span<const uint64_t> weights,
+  uint64_t n_threads) {
+  assert(weights.empty() || (weights.size() == keys.size()));
+  vector<uint64_t> bounds = split_keys(keys, n_threads);
+  vector<Postorder> parts(bounds.size() - 1);
+  parallel(n_threads, parts.size(), [&](uint64_t part_id) {
+    for (uint64_t i = bounds[part_id]; i < bounds[part_id + 1]; ++i) {
+      parts[part_id].add(keys[i], weights.empty() ? 0 : weights[i]);
     }
-    if (node.begin < node.end) {
-      uint64_t level_id = node.level_id;
-      uint64_t node_pos = middle;
-      uint64_t node_id = node_pos - trie.levels[level_id].louds.rank1(middle);
-      labels_.push_back(trie.levels[level_id].labels[node_id]);
-      for ( ; ; ) {
-        node_pos = (node_id == 0) ? 0 :
-          trie.levels[level_id + 1].louds.select1(node_id - 1) + 1;
-        if (trie.levels[level_id].outs[node_id] ||
-          !trie.levels[level_id + 1].louds[node_pos + 1]) {
-          break;
-        }
-        node_id = node_pos - node_id;
-        tail_bits_.add(level_id == node.level_id);
-        ++level_id;
-        tail_bytes_.push_back(trie.levels[level_id].labels[node_id]);
-      }
-      if (!trie.levels[level_id + 1].louds[node_pos]) {
-        tree_.add(1);
-        queue.push(Node{ level_id + 1, node_pos,
-          trie.levels[level_id + 1].louds.select1(node_id) });
+    parts[part_id].finish();
+  });
+  build(parts, n_threads);
+}
+
+// build() places the nodes of parts in level order of the tree. The
+// siblings of a node at depth d of the trie go below the middle child of
+// its parent, so their depth in the tree follows from the depth of the
+// parent, which is kept in tree_depths[d - 1], and from split(). The parts
+// share the root, whose children are numbered across the parts, and a level
+// below it is the concatenation of the levels of the parts. If the parts
+// have weights, the depths of siblings come from shape_siblings() instead.
+void TSTree::build(span<const Postorder> parts, uint64_t n_threads) {
+  uint64_t bv_flags = 0;
+  if (flags_ & TRIE_INTERLEAVED) {
+    bv_flags |= BitVector::INTERLEAVED;
+  }
+  uint64_t cbv_flags = bv_flags;
+  if (flags_ & TRIE_COMPRESSED) {
+    cbv_flags |= BitVector::COMPRESSED;
+  }
+
+  // The children of the root in a part start at sibling_bases[part_id].
+  vector<uint64_t> sibling_bases(parts.size());
+  bool root_out = false;
+  uint64_t n_root_children = 0;
+  for (uint64_t i = 0; i < parts.size(); ++i) {
+    Postorder::Node root;
+    Postorder::Reader reader(parts[i]);
+    reader.next(root);
+    sibling_bases[i] = n_root_children;
+    root_out |= root.out;
+    n_root_children += root.n_children;
+  }
+  bool weighted = false;
+  for (uint64_t i = 0; i < parts.size(); ++i) {
+    weighted |= parts[i].weighted();
+  }
+  vector<vector<Shape>> shapes(parts.size());
+  if (weighted) {
+    shape_siblings(parts, sibling_bases, n_root_children, n_threads, shapes);
+  }
+  auto tree_depth = [&](uint64_t part_id, uint64_t node_index,
+    const Postorder::Node &node, vector<uint64_t> &tree_depths, bool &lo,
+    bool &hi) {
+    uint64_t depth = 0;
+    if (node.depth != 0) {
+      if (weighted) {
+        const Shape &shape = shapes[part_id][node_index];
+        lo = shape.lo;
+        hi = shape.hi;
+        depth = shape.depth;
+      } else if (node.depth == 1) {
+        depth = split(sibling_bases[part_id] + node.sibling_id,
+          n_root_children, lo, hi);
       } else {
-        tree_.add(0);
+        depth = split(node.sibling_id, node.n_siblings, lo, hi);
       }
-      links_.add(level_id > node.level_id);
-      outs_.add(trie.levels[level_id].outs[node_id]);
-    } else {
-      tree_.add(0);
+      depth += tree_depths[node.depth - 1] + 1;
     }
-    if (middle + 1 < node.end) {
-      tree_.add(1);
-      queue.push(Node{ node.level_id, middle + 1, node.end });
-    } else {
-      tree_.add(0);
+    tree_depths.resize(node.depth);
+    tree_depths.push_back(depth);
+    return depth;
+  };
+
+  // levels[part_id][depth - 1] is for the nodes at depth of a part.
+  vector<vector<Level>> levels(parts.size());
+  parallel(n_threads, parts.size(), [&](uint64_t part_id) {
+    vector<uint64_t> tree_depths;
+    Postorder::Node node;
+    bool lo = false;
+    bool hi = false;
+    Postorder::Reader reader(parts[part_id]);
+    reader.next(node);
+    tree_depth(part_id, 0, node, tree_depths, lo, hi);
+    for (uint64_t i = 1; reader.next(node); ++i) {
+      uint64_t depth = tree_depth(part_id, i, node, tree_depths, lo, hi);
+      if (depth > levels[part_id].size()) {
+        levels[part_id].resize(depth, Level{ 0, 0 });
+      }
+      ++levels[part_id][depth - 1].node_id;
+      levels[part_id][depth - 1].tail_pos += node.tail_length;
+    }
+  });
+  uint64_t max_depth = 0;
+  for (uint64_t i = 0; i < parts.size(); ++i) {
+    max_depth = max(max_depth, (uint64_t)levels[i].size());
+  }
+  Level end = { 1, 0 };
+  for (uint64_t depth = 0; depth < max_depth; ++depth) {
+    for (uint64_t i = 0; i < parts.size(); ++i) {
+      if (depth < levels[i].size()) {
+        Level &level = levels[i][depth];
+        end.node_id += level.node_id;
+        end.tail_pos += level.tail_pos;
+        level = end;
+      }
     }
-    queue.pop();
   }
 
-  tree_.build();
-  outs_.build();
-  links_.build();
+  tree_.resize(end.node_id * 3);
+  tree_.set(1, n_root_children != 0);
+  outs_.resize(end.node_id);
+  outs_.set(0, root_out);
+  links_.resize(end.node_id);
+  labels_.resize(end.node_id);
+  labels_[0] = ' ';
+  tail_bits_.resize(end.tail_pos);
+  tail_bytes_.resize(end.tail_pos);
+  parallel(n_threads, parts.size(), [&](uint64_t part_id) {
+    vector<uint64_t> tree_depths;
+    Postorder::Node node;
+    bool lo = false;
+    bool hi = false;
+    Postorder::Reader reader(parts[part_id]);
+    reader.next(node);
+    tree_depth(part_id, 0, node, tree_depths, lo, hi);
+    for (uint64_t i = 1; reader.next(node); ++i) {
+      uint64_t depth = tree_depth(part_id, i, node, tree_depths, lo, hi);
+      Level &level = levels[part_id][depth - 1];
+      uint64_t node_id = --level.node_id;
+      labels_[node_id] = node.label;
+      if (node.out) {
+        outs_.set_shared(node_id);
+      }
+      if (lo) {
+        tree_.set_shared(node_id * 3);
+      }
+      if (node.n_children != 0) {
+        tree_.set_shared((node_id * 3) + 1);
+      }
+      if (hi) {
+        tree_.set_shared((node_id * 3) + 2);
+      }
+      if (node.tail_length != 0) {
+        links_.set_shared(node_id);
+        level.tail_pos -= node.tail_length;
+        tail_bits_.set_shared(level.tail_pos);
+        for (uint64_t i = 0; i < node.tail_length; ++i) {
+          tail_bytes_[level.tail_pos + i] = node.tail[i];
+        }
+      }
+    }
+  });
+
+  tree_.build(bv_flags | BitVector::SELECT1, n_threads);
+  outs_.build(cbv_flags | BitVector::SELECT1, n_threads);
+  links_.build(cbv_flags, n_threads);
   tail_bits_.add(1);
-  tail_bits_.build();
+  tail_bits_.build(bv_flags | BitVector::SELECT1, n_threads);
 
-  n_keys_ = trie.n_keys;
+  n_keys_ = 0;
+  for (uint64_t i = 0; i < parts.size(); ++i) {
+    n_keys_ += parts[i].n_keys();
+  }
   n_nodes_ = outs_.n_bits;
   size_ = tree_.size();
   size_ += outs_.size();
@@ -182,7 +322,8 @@ void TSTree::build(const vector<string> &keys) {
 }
 
 uint64_t TSTree::lookup(const string &query) const {
-  uint64_t node_id = 1;
+  // The empty key is stored in the root, whose middle child is node 1.
+  uint64_t node_id = query.empty() ? 0 : 1;
   for (uint64_t i = 0; i < query.length(); ) {
     uint8_t byte = query[i];
     if (byte < labels_[node_id]) {
@@ -256,4 +397,198 @@ void TSTree::reverse_lookup(uint64_t id, string &key) const {
   reverse(key.begin(), key.end());
 }
 
+bool TSTree::Cursor::next() {
+  while (!stack_.empty()) {
+    Frame &frame = stack_.back();
+    uint64_t node_id = frame.node_id;
+    uint64_t key_length = frame.key_length;
+    switch (frame.step) {
+      case LO: {
+        frame.step = MIDDLE;
+        uint64_t child_id = trie_->child(node_id * 3);
+        if (child_id != 0) {
+          stack_.push_back(Frame{ child_id, key_length, LO });
+        }
+        break;
+      }
+      case MIDDLE: {
+        frame.step = HI;
+        key_.resize(key_length);
+        if (node_id != 0) {
+          key_.push_back(trie_->labels_[node_id]);
+          if (trie_->links_[node_id]) {
+            uint64_t tail_pos =
+              trie_->tail_bits_.select1(trie_->links_.rank1(node_id));
+            do {
+              key_.push_back(trie_->tail_bytes_[tail_pos]);
+            } while (!trie_->tail_bits_[++tail_pos]);
+          }
+        }
+        uint64_t child_id = trie_->child((node_id * 3) + 1);
+        if (child_id != 0) {
+          stack_.push_back(Frame{ child_id, key_.length(), LO });
+        }
+        if (trie_->outs_[node_id]) {
+          id_ = trie_->outs_.rank1(node_id);
+          return true;
+        }
+        break;
+      }
+      case HI: {
+        // The hi subtree replaces the node. The bottom frame is the root of
+        // the search and its siblings are out of range.
+        stack_.pop_back();
+        uint64_t child_id = trie_->child((node_id * 3) + 2);
+        if (child_id != 0 && !stack_.empty()) {
+          stack_.push_back(Frame{ child_id, key_length, LO });
+        }
+        break;
+      }
+    }
+  }
+  return false;
+}
+
+void TSTree::predictive_search(string_view prefix, Cursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.stack_.clear();
+  cursor.key_.clear();
+  cursor.id_ = -1;
+  uint64_t node_id = 0;
+  uint64_t key_length = 0;
+  for (uint64_t i = 0; i < prefix.length(); ) {
+    if (node_id == 0) {
+      node_id = child(1);
+    } else {
+      uint8_t byte = prefix[i];
+      if (byte < labels_[node_id]) {
+        node_id = child(node_id * 3);
+      } else if (byte > labels_[node_id]) {
+        node_id = child((node_id * 3) + 2);
+      } else {
+        key_length = i++;
+        if (links_[node_id]) {
+          // The prefix may end in the middle of the tail.
+          uint64_t tail_pos = tail_bits_.select1(links_.rank1(node_id));
+          do {
+            if (i == prefix.length()) {
+              break;
+            } else if (tail_bytes_[tail_pos] != (uint8_t)prefix[i]) {
+              return;
+            }
+            ++i;
+          } while (!tail_bits_[++tail_pos]);
+        }
+        if (i == prefix.length()) {
+          break;
+        }
+        node_id = child((node_id * 3) + 1);
+      }
+    }
+    if (node_id == 0) {
+      return;
+    }
+  }
+  cursor.key_.assign(prefix.substr(0, key_length));
+  cursor.stack_.push_back(Cursor::Frame{ node_id, key_length, Cursor::MIDDLE });
+}
+
+bool TSTree::PrefixCursor::next() {
+  while (node_id_ != (uint64_t)-1) {
+    uint64_t node_id = node_id_;
+    length_ = pos_;
+    // Move on to the middle descendant which matches the query, if any.
+    node_id_ = -1;
+    if (pos_ < query_.length()) {
+      uint8_t byte = query_[pos_];
+      uint64_t child_id = trie_->child((node_id * 3) + 1);
+      while (child_id != 0 && byte != trie_->labels_[child_id]) {
+        if (byte < trie_->labels_[child_id]) {
+          child_id = trie_->child(child_id * 3);
+        } else {
+          child_id = trie_->child((child_id * 3) + 2);
+        }
+      }
+      if (child_id != 0) {
+        ++pos_;
+        if (trie_->links_[child_id]) {
+          uint64_t tail_pos =
+            trie_->tail_bits_.select1(trie_->links_.rank1(child_id));
+          do {
+            if (pos_ == query_.length() ||
+                trie_->tail_bytes_[tail_pos] != (uint8_t)query_[pos_]) {
+              child_id = 0;
+              break;
+            }
+            ++pos_;
+          } while (!trie_->tail_bits_[++tail_pos]);
+        }
+        if (child_id != 0) {
+          node_id_ = child_id;
+        }
+      }
+    }
+    if (trie_->outs_[node_id]) {
+      id_ = trie_->outs_.rank1(node_id);
+      return true;
+    }
+  }
+  return false;
+}
+
+void TSTree::common_prefix_search(string_view query,
+  PrefixCursor &cursor) const {
+  cursor.trie_ = this;
+  cursor.query_ = query;
+  cursor.node_id_ = 0;
+  cursor.pos_ = 0;
+  cursor.length_ = 0;
+  cursor.id_ = -1;
+}
+
+bool TSTree::save(const char *path) const {
+  Writer writer;
+  if (!writer.open(path)) {
+    return false;
+  }
+  writer.write_header(name());
+  tree_.write(writer);
+  outs_.write(writer);
+  links_.write(writer);
+  labels_.write(writer);
+  tail_bits_.write(writer);
+  tail_bytes_.write(writer);
+  writer.write(n_keys_);
+  writer.write(n_nodes_);
+  writer.write(size_);
+  writer.write(flags_);
+  return writer.close();
+}
+
+bool TSTree::map(const char *path) {
+  Mapper mapper;
+  if (!mapper.open(path) || !mapper.map_header(name())) {
+    return false;
+  }
+  // The file is mapped into a new trie, so that this one is kept if the
+  // file is broken.
+  TSTree trie;
+  trie.tree_.map(mapper);
+  trie.outs_.map(mapper);
+  trie.links_.map(mapper);
+  trie.labels_.map(mapper);
+  trie.tail_bits_.map(mapper);
+  trie.tail_bytes_.map(mapper);
+  mapper.map(trie.n_keys_);
+  mapper.map(trie.n_nodes_);
+  mapper.map(trie.size_);
+  mapper.map(trie.flags_);
+  if (!mapper.ok()) {
+    return false;
+  }
+  trie.mapper_ = move(mapper);
+  *this = move(trie);
+  return true;
+}
+
 }  // namespace trie_eval
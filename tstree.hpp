@@ -2,6 +2,8 @@
 #define TSTREE_HPP
 
 #include "bit-vector.hpp"
+#include "compressed-bit-vector.hpp"
+#include "postorder.hpp"
 #include "trie-base.hpp"
 
 namespace trie_eval {
@@ -10,14 +12,130 @@ using namespace std;
 
 class TSTree : TrieBase {
  public:
-  TSTree();
+  explicit TSTree(uint64_t flags = 0);
   ~TSTree() {}
 
+  TSTree(TSTree &&) = default;
+  TSTree &operator=(TSTree &&) = default;
+
+  // Builder builds a trie from keys given one at a time in sorted order, so
+  // that they need not be in memory at once. A key may have a weight, such
+  // as its query count (see build() with weights).
+  class Builder {
+   public:
+    explicit Builder(TSTree &trie) : trie_(trie), postorder_() {}
+
+    void add(string_view key, uint64_t weight = 0) {
+      postorder_.add(key, weight);
+    }
+    void finish();
+
+   private:
+    TSTree &trie_;
+    Postorder postorder_;
+  };
+
   void build(const vector<string> &keys);
+  // build() with n_threads splits keys by their first bytes and builds the
+  // parts on up to n_threads threads. The trie is the same as with one.
+  void build(const vector<string> &keys, uint64_t n_threads);
+  // build() with weights, such as the query counts of keys, splits the
+  // siblings of a node at the sibling which balances their weights, so that
+  // heavy keys take fewer steps. Siblings of no weight are split at the
+  // middle as usual.
+  void build(const vector<string> &keys, span<const uint64_t> weights,
+    uint64_t n_threads = 1);
 
   uint64_t lookup(const string &query) const;
   void reverse_lookup(uint64_t id, string &key) const;
 
+  // lookup_batch() and reverse_lookup_batch() are those of TrieBase. A
+  // step is a rank1() or a select1(), whose branches cost more than its
+  // cache misses, so interleaving steps of queries makes them slower.
+  using TrieBase::lookup_batch;
+  using TrieBase::reverse_lookup_batch;
+
+  // Cursor enumerates keys in lexicographic order. key() is a buffer which
+  // is reused by next(), so no string is allocated per key.
+  class Cursor {
+   public:
+    Cursor() : trie_(nullptr), stack_(), key_(), id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    const string &key() const {
+      return key_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class TSTree;
+
+    // A node is visited in three steps: its lo subtree, the node itself
+    // followed by its middle subtree, and its hi subtree.
+    enum Step {
+      LO,
+      MIDDLE,
+      HI,
+    };
+
+    struct Frame {
+      uint64_t node_id;
+      uint64_t key_length;
+      Step step;
+    };
+
+    const TSTree *trie_;
+    vector<Frame> stack_;
+    string key_;
+    uint64_t id_;
+  };
+
+  // predictive_search() sets cursor to the keys which start with prefix.
+  void predictive_search(string_view prefix, Cursor &cursor) const;
+
+  // PrefixCursor enumerates the keys which are prefixes of a query in order
+  // of length.
+  class PrefixCursor {
+   public:
+    PrefixCursor()
+      : trie_(nullptr), query_(), node_id_(-1), pos_(0), length_(0),
+        id_(-1) {}
+
+    // next() moves on to the next key and returns false at the end.
+    bool next();
+
+    // The key is the first length() bytes of the query.
+    uint64_t length() const {
+      return length_;
+    }
+    uint64_t id() const {
+      return id_;
+    }
+
+   private:
+    friend class TSTree;
+
+    const TSTree *trie_;
+    string_view query_;
+    // node_id_ is the next node to visit and the first pos_ bytes of the
+    // query are its key.
+    uint64_t node_id_;
+    uint64_t pos_;
+    uint64_t length_;
+    uint64_t id_;
+  };
+
+  // common_prefix_search() sets cursor to the keys which are prefixes of
+  // query.
+  void common_prefix_search(string_view query, PrefixCursor &cursor) const;
+
+  bool save(const char *path) const;
+  bool map(const char *path);
+
   const char *name() const {
     return "Ternary search tree + labels";
   }
@@ -30,17 +148,31 @@ class TSTree : TrieBase {
   uint64_t size() const {
     return size_;
   }
+  uint64_t flags() const {
+    return flags_;
+  }
 
  private:
+  friend class BlockedTSTree;
+
   BitVector tree_;
-  BitVector outs_;
-  BitVector links_;
-  vector<uint8_t> labels_;
+  CompressedBitVector outs_;
+  CompressedBitVector links_;
+  Vector<uint8_t> labels_;
   BitVector tail_bits_;
-  vector<uint8_t> tail_bytes_;
+  Vector<uint8_t> tail_bytes_;
   uint64_t n_keys_;
   uint64_t n_nodes_;
   uint64_t size_;
+  uint64_t flags_;
+  Mapper mapper_;
+
+  void build(span<const Postorder> parts, uint64_t n_threads);
+
+  // child() returns the ID of the child at node_pos or 0 if there is none.
+  uint64_t child(uint64_t node_pos) const {
+    return tree_[node_pos] ? (tree_.rank1(node_pos) + 1) : 0;
+  }
 };
 
 }  // namespace trie_eval
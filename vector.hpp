@@ -0,0 +1,144 @@
+#ifndef VECTOR_HPP
+#define VECTOR_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "io.hpp"
+
+namespace trie_eval {
+
+using namespace std;
+
+// Vector is a subset of vector which can also refer to an array in a mapped
+// file. A mapped Vector is read-only.
+template <typename T>
+class Vector {
+ public:
+  Vector() : buf_(), ptr_(nullptr), size_(0) {}
+  ~Vector() {}
+
+  Vector(const Vector &rhs)
+    : buf_(rhs.buf_), ptr_(rhs.ptr_), size_(rhs.size_) {
+    if (!rhs.mapped()) {
+      ptr_ = buf_.data();
+    }
+  }
+  Vector(Vector &&rhs)
+    : buf_(move(rhs.buf_)), ptr_(rhs.ptr_), size_(rhs.size_) {
+    rhs.ptr_ = nullptr;
+    rhs.size_ = 0;
+  }
+  Vector &operator=(Vector rhs) {
+    swap(rhs);
+    return *this;
+  }
+
+  void swap(Vector &rhs) {
+    buf_.swap(rhs.buf_);
+    std::swap(ptr_, rhs.ptr_);
+    std::swap(size_, rhs.size_);
+  }
+
+  bool mapped() const {
+    return ptr_ != buf_.data();
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  uint64_t size() const {
+    return size_;
+  }
+
+  const T *data() const {
+    return ptr_;
+  }
+  const T *begin() const {
+    return ptr_;
+  }
+  const T *end() const {
+    return ptr_ + size_;
+  }
+
+  const T &operator[](uint64_t i) const {
+    assert(i < size_);
+    return ptr_[i];
+  }
+  T &operator[](uint64_t i) {
+    assert(!mapped());
+    return buf_[i];
+  }
+  const T &back() const {
+    assert(size_ != 0);
+    return ptr_[size_ - 1];
+  }
+  T &back() {
+    assert(!mapped());
+    return buf_.back();
+  }
+
+  void push_back(const T &value) {
+    assert(!mapped());
+    buf_.push_back(value);
+    sync();
+  }
+  void resize(uint64_t n) {
+    assert(!mapped());
+    buf_.resize(n);
+    sync();
+  }
+  void resize(uint64_t n, const T &value) {
+    assert(!mapped());
+    buf_.resize(n, value);
+    sync();
+  }
+  void reserve(uint64_t n) {
+    assert(!mapped());
+    buf_.reserve(n);
+    sync();
+  }
+  void clear() {
+    buf_.clear();
+    sync();
+  }
+
+  // An array is written as its number of elements followed by the elements,
+  // padded to a multiple of 8 bytes.
+  void write(Writer &writer) const {
+    writer.write(size_);
+    writer.align(alignof(T) > 8 ? alignof(T) : 8);
+    writer.write(ptr_, sizeof(T) * size_);
+    writer.align(8);
+  }
+  void map(Mapper &mapper) {
+    uint64_t size = 0;
+    mapper.map(size);
+    mapper.align(alignof(T) > 8 ? alignof(T) : 8);
+    mapper.check(size <= mapper.remaining() / sizeof(T));
+    const void *ptr = mapper.map_bytes(sizeof(T) * size);
+    mapper.align(8);
+    buf_.clear();
+    buf_.shrink_to_fit();
+    if (ptr != nullptr) {
+      ptr_ = static_cast<const T *>(ptr);
+      size_ = size;
+    } else {
+      sync();
+    }
+  }
+
+ private:
+  vector<T> buf_;
+  const T *ptr_;
+  uint64_t size_;
+
+  void sync() {
+    ptr_ = buf_.data();
+    size_ = buf_.size();
+  }
+};
+
+}  // namespace trie_eval
+
+#endif  // VECTOR_HPP